@@ -0,0 +1,35 @@
+//fuzz_listing.c
+//libFuzzer harness for the web listing parsers
+#include "../src/fileutils.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FUZZ_MAX_FILES 256
+
+typedef int (*parser_fn)(const char *, const char *, char *[], int);
+
+static void run(parser_fn parse, const char *body, const char *base_url) {
+  char *files[FUZZ_MAX_FILES];
+  int count = parse(body, base_url, files, FUZZ_MAX_FILES);
+  if (count < 0 || count > FUZZ_MAX_FILES)
+    abort();
+  for (int i = 0; i < count; i++)
+    free(files[i]);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  //parsers take nul terminated bodies, like the curl write callback builds
+  char *body = malloc(size + 1);
+  if (!body)
+    return 0;
+  memcpy(body, data, size);
+  body[size] = '\0';
+
+  run(parse_apache_listing, body, "http://fuzz.local/dir/");
+  run(parse_nginx_listing, body, "http://fuzz.local/dir");
+  run(parse_json_listing, body, "http://fuzz.local/dir/");
+
+  free(body);
+  return 0;
+}
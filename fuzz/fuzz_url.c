@@ -0,0 +1,32 @@
+//fuzz_url.c
+//libFuzzer harness for url credential parsing and file classification
+#include "../src/fileutils.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  char *input = malloc(size + 1);
+  if (!input)
+    return 0;
+  memcpy(input, data, size);
+  input[size] = '\0';
+
+  is_allowed_filetype(input);
+  is_web_url(input);
+
+  char *clean_url = NULL;
+  char *username = NULL;
+  char *password = NULL;
+  extract_auth_from_url(input, &clean_url, &username, &password);
+
+  //credentials come out of the url, never more than was put in
+  if (!clean_url || strlen(clean_url) > size)
+    abort();
+
+  free(clean_url);
+  free(username);
+  free(password);
+  free(input);
+  return 0;
+}
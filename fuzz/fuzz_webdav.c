@@ -0,0 +1,28 @@
+//fuzz_webdav.c
+//libFuzzer harness for the streaming PROPFIND multistatus parser
+#include "../src/webdav.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  if (size == 0)
+    return 0;
+
+  //first byte picks the chunk size, so tags get split at every offset
+  size_t chunk = data[0] + 1;
+  const char *body = (const char *)data + 1;
+  size_t len = size - 1;
+
+  webdav_entry *entries;
+  int count = webdav_parse(body, len, chunk, "http://fuzz.local/dav/",
+                           &entries);
+  if (count < 0)
+    return 0;
+
+  for (int i = 0; i < count; i++) {
+    if (!entries[i].url)
+      abort();
+  }
+  webdav_free_entries(entries, count);
+  return 0;
+}
@@ -0,0 +1,29 @@
+//standalone.c
+//runs a harness over files without libFuzzer, for gcc builds and for
+//replaying crashes: ./fuzz_listing_standalone crash-1234
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int main(int argc, char *argv[]) {
+  for (int i = 1; i < argc; i++) {
+    FILE *fp = fopen(argv[i], "rb");
+    if (!fp) {
+      perror(argv[i]);
+      return 1;
+    }
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    uint8_t *data = malloc(len > 0 ? len : 1);
+    size_t size = fread(data, 1, len, fp);
+    fclose(fp);
+
+    LLVMFuzzerTestOneInput(data, size);
+    free(data);
+  }
+  return 0;
+}
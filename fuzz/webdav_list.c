@@ -0,0 +1,24 @@
+//webdav_list.c
+//prints what webdav_list finds below a url, one "url size etag" per line.
+//driven by webdav_standin.py, see make webdav-check
+#include "../src/webdav.h"
+#include <stdio.h>
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <url>\n", argv[0]);
+    return 2;
+  }
+
+  webdav_entry *entries;
+  int count = webdav_list(argv[1], NULL, NULL, &entries);
+  if (count < 0)
+    return 1;
+
+  for (int i = 0; i < count; i++)
+    printf("%s %lld %s\n", entries[i].url, entries[i].size,
+           entries[i].etag ? entries[i].etag : "-");
+
+  webdav_free_entries(entries, count);
+  return 0;
+}
@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+# webdav_standin.py
+# scripted PROPFIND server for checking the webdav lister end to end:
+#   python3 fuzz/webdav_standin.py ./fuzz/webdav_list
+# serves the same tree twice, once answering Depth: infinity and once
+# refusing it with 403 so the Depth: 1 walk runs. the refusing server names
+# itself 127.0.0.1 in hrefs while the client asks for localhost, and spells
+# percent escapes differently per level, the cases that once listed the
+# tree twice. bodies are written in small pieces to split tags across
+# chunks
+import http.server
+import re
+import subprocess
+import sys
+import threading
+from urllib.parse import quote, unquote, urlsplit
+
+TREE = {
+    "/dav/": ["a.mp3", "Disc 1/", "Bj\u00f8rk/", "sub/"],
+    "/dav/Disc 1/": ["01 - Intro.mp3", "cover.jpg"],
+    "/dav/Bj\u00f8rk/": ["\u00e9t\u00e9.mp3"],
+    "/dav/sub/": ["deep/"],
+    "/dav/sub/deep/": ["x.flac"],
+}
+
+
+def walk(path):
+    yield path
+    for name in TREE.get(path, []):
+        child = path + name
+        if child.endswith("/"):
+            yield from walk(child)
+        else:
+            yield child
+
+
+def lower_escapes(s):
+    return re.sub(r"%[0-9A-F]{2}", lambda m: m.group().lower(), s)
+
+
+def upper_escapes(s):
+    return re.sub(r"%[0-9a-f]{2}", lambda m: m.group().upper(), s)
+
+
+def href(path, absolute, lower):
+    encoded = quote(path)
+    if lower:
+        encoded = lower_escapes(encoded)
+    return ("http://127.0.0.1:%d" % PORT + encoded) if absolute else encoded
+
+
+def response(path, absolute=False, lower=False):
+    if path.endswith("/"):
+        prop = "<D:resourcetype><D:collection/></D:resourcetype>"
+    else:
+        prop = ("<D:resourcetype/><D:getcontentlength>%d</D:getcontentlength>"
+                "<D:getetag>\"%x\"</D:getetag>" % (len(path), len(path)))
+    return ("<D:response><D:href>%s</D:href><D:propstat><D:prop>%s</D:prop>"
+            "<D:status>HTTP/1.1 200 OK</D:status></D:propstat></D:response>\n"
+            % (href(path, absolute, lower), prop))
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    allow_infinity = True
+    requests = []
+
+    def log_message(self, *args):
+        pass
+
+    def do_PROPFIND(self):
+        self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        path = unquote(urlsplit(self.path).path)
+        depth = self.headers.get("Depth", "infinity")
+        Handler.requests.append((path, depth))
+
+        if path not in TREE:
+            self.send_error(404)
+            return
+        if depth == "infinity" and not Handler.allow_infinity:
+            page = b"<html><body><h1>403 propfind-finite-depth</h1>" + b"x" * 100000
+            self.send_response(403)
+            self.send_header("Content-Length", str(len(page)))
+            self.end_headers()
+            self.wfile.write(page)
+            return
+
+        if depth == "infinity":
+            paths = list(walk(path))
+        else:
+            paths = [path] + [path + name for name in TREE[path]]
+        body = '<?xml version="1.0" encoding="utf-8"?>\n'
+        body += '<D:multistatus xmlns:D="DAV:">\n'
+        for i, p in enumerate(paths):
+            refusing = not Handler.allow_infinity
+            body += response(p, absolute=refusing and p == path,
+                             lower=refusing and i % 2 == 0)
+        body += "</D:multistatus>\n"
+        data = body.encode()
+
+        self.send_response(207)
+        self.send_header("Content-Type", "application/xml")
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        for off in range(0, len(data), 97):
+            self.wfile.write(data[off:off + 97])
+            self.wfile.flush()
+
+
+def expected():
+    out = []
+    for p in walk("/dav/"):
+        if not p.endswith("/"):
+            out.append("http://localhost:%d%s %d \"%x\"" %
+                       (PORT, quote(p), len(p), len(p)))
+    return sorted(out)
+
+
+def run(lister, allow_infinity):
+    Handler.allow_infinity = allow_infinity
+    Handler.requests = []
+    result = subprocess.run([lister, "http://localhost:%d/dav/" % PORT],
+                            capture_output=True, text=True)
+    got = sorted(upper_escapes(line) for line in result.stdout.splitlines())
+    mode = "infinity" if allow_infinity else "depth 1"
+    ok = result.returncode == 0 and got == expected()
+
+    fetched = [p for p, d in Handler.requests if d == "1"]
+    if len(fetched) != len(set(fetched)):
+        print("%s: collections fetched twice: %s" % (mode, fetched))
+        ok = False
+    if not allow_infinity and sorted(set(fetched)) != sorted(TREE):
+        print("%s: walked %s" % (mode, fetched))
+        ok = False
+
+    if not ok:
+        print("%s: FAIL\n%s" % (mode, result.stderr))
+        print("\n".join("got      " + line for line in got))
+        print("\n".join("expected " + line for line in expected()))
+    else:
+        print("%s: ok, %d entries in %d requests" %
+              (mode, len(got), len(Handler.requests)))
+    return ok
+
+
+if __name__ == "__main__":
+    server = http.server.ThreadingHTTPServer(("127.0.0.1", 0), Handler)
+    PORT = server.server_address[1]
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+
+    ok = run(sys.argv[1], True)
+    ok = run(sys.argv[1], False) and ok
+    server.shutdown()
+    sys.exit(0 if ok else 1)
@@ -0,0 +1,461 @@
+//combine.c
+#include "combine.h"
+#include "fileutils.h"
+#include <fcntl.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+  media_file mf;
+  size_t seq; //input order, keeps the sort stable
+} combine_entry;
+
+typedef struct {
+  char **paths;
+  int npaths;
+  int next;
+  pthread_mutex_t lock;
+  media_file **results;
+  int *counts;
+} combine_jobs;
+
+static void print_combine_usage(const char *name) {
+  printf("Usage: %s combine [OPTIONS] <output> <playlist>...\n", name);
+  printf("Merges existing m3u/m3u8 playlists sorted by path, dropping repeated\n");
+  printf("paths. Nothing is probed.\n");
+  printf("Opts:\n");
+  printf("  -v, --verbose          Enable verbose output\n");
+  printf("  -n, --max-entries N    Split output into files of at most N entries\n");
+  printf("  -t, --max-duration S   Split output into files of at most S seconds\n");
+  printf("  -j, --jobs N           Parse N playlists at once (default: cpus)\n");
+  printf("  -h, --help             Show this help message\n");
+}
+
+static char *copy_range(const char *start, const char *end) {
+  char *s = malloc(end - start + 1);
+  memcpy(s, start, end - start);
+  s[end - start] = '\0';
+  return s;
+}
+
+//drops empty and "." segments and resolves ".." of an absolute path, in
+//place. purely lexical, the file need not exist and symlinks stay as written
+static void normalize_path(char *path) {
+  char *out = path + 1;
+  char *p = path + 1;
+
+  while (*p) {
+    char *seg_end = strchr(p, '/');
+    if (!seg_end)
+      seg_end = p + strlen(p);
+    size_t len = seg_end - p;
+
+    if (len == 2 && p[0] == '.' && p[1] == '.') {
+      //back to the start of the previous segment
+      if (out > path + 1) {
+        out--;
+        while (out > path + 1 && out[-1] != '/')
+          out--;
+      }
+    }
+    else if (len > 0 && !(len == 1 && p[0] == '.')) {
+      memmove(out, p, len);
+      out += len;
+      if (*seg_end)
+        *out++ = '/';
+    }
+
+    p = *seg_end ? seg_end + 1 : seg_end;
+  }
+
+  if (out > path + 1 && out[-1] == '/')
+    out--;
+  *out = '\0';
+}
+
+//relative entries are relative to the playlist, not to where we run. they
+//come out absolute so the output is right wherever it is written, and
+//normalised so "./a.mp3" and "a.mp3" dedupe as one path
+static char *resolve_entry(const char *dir, const char *start,
+                           const char *end) {
+  char *entry = copy_range(start, end);
+  if (strstr(entry, "://"))
+    return entry;
+
+  if (entry[0] != '/') {
+    if (!dir)
+      return entry;
+
+    size_t len = strlen(dir) + strlen(entry) + 2;
+    char *full = malloc(len);
+    snprintf(full, len, "%s/%s", dir, entry);
+    free(entry);
+    entry = full;
+  }
+
+  normalize_path(entry);
+  return entry;
+}
+
+//#EXTINF:<duration>[ attributes],<title>
+static void parse_extinf(const char *p, const char *end, double *duration,
+                         const char **title, const char **title_end) {
+  char number[32];
+  size_t len = 0;
+  while (p < end && len < sizeof(number) - 1 && *p != ',' && *p != ' ')
+    number[len++] = *p++;
+  number[len] = '\0';
+  *duration = len ? strtod(number, NULL) : -1;
+
+  //attributes may quote commas
+  int quoted = 0;
+  while (p < end && (quoted || *p != ',')) {
+    if (*p == '"')
+      quoted = !quoted;
+    p++;
+  }
+
+  *title = p < end ? p + 1 : end;
+  *title_end = end;
+}
+
+//maps path and collects its entries. lines other than #EXTINF and entry
+//paths are skipped, entries without #EXTINF get an unknown duration
+int read_m3u(const char *path, media_file **out, int *out_count) {
+  *out = NULL;
+  *out_count = 0;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+
+  const char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    perror(path);
+    return -1;
+  }
+  madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+
+  char *path_copy = strdup(path);
+  char *dir = realpath(dirname(path_copy), NULL);
+  free(path_copy);
+
+  int capacity = 256;
+  int count = 0;
+  media_file *mfs = malloc(capacity * sizeof(media_file));
+
+  const char *p = data;
+  const char *end = data + st.st_size;
+  double duration = -1;
+  const char *title = NULL, *title_end = NULL;
+
+  //utf-8 bom
+  if (end - p >= 3 && memcmp(p, "\xef\xbb\xbf", 3) == 0)
+    p += 3;
+
+  while (mfs && p < end) {
+    const char *nl = memchr(p, '\n', end - p);
+    const char *line_end = nl ? nl : end;
+    const char *next = nl ? nl + 1 : end;
+    if (line_end > p && line_end[-1] == '\r')
+      line_end--;
+
+    while (p < line_end && (*p == ' ' || *p == '\t'))
+      p++;
+
+    if (line_end - p > 8 && strncmp(p, "#EXTINF:", 8) == 0) {
+      parse_extinf(p + 8, line_end, &duration, &title, &title_end);
+    }
+    else if (p < line_end && *p != '#') {
+      if (count == capacity) {
+        capacity *= 2;
+        media_file *grown = realloc(mfs, capacity * sizeof(media_file));
+        if (!grown)
+          break;
+        mfs = grown;
+      }
+
+      media_file *mf = &mfs[count++];
+      mf->path = resolve_entry(dir, p, line_end);
+      char *name = strrchr(mf->path, '/');
+      mf->filename = strdup(name && name[1] ? name + 1 : mf->path);
+      mf->duration = duration;
+      mf->title = title && title < title_end ? copy_range(title, title_end)
+                                             : NULL;
+
+      duration = -1;
+      title = title_end = NULL;
+    }
+
+    p = next;
+  }
+
+  munmap((void *)data, st.st_size);
+  free(dir);
+
+  *out = mfs;
+  *out_count = count;
+  return mfs ? 0 : -1;
+}
+
+static void *combine_worker(void *arg) {
+  combine_jobs *jobs = arg;
+
+  for (;;) {
+    pthread_mutex_lock(&jobs->lock);
+    int i = jobs->next++;
+    pthread_mutex_unlock(&jobs->lock);
+    if (i >= jobs->npaths)
+      break;
+
+    if (read_m3u(jobs->paths[i], &jobs->results[i], &jobs->counts[i]) != 0)
+      jobs->counts[i] = -1;
+  }
+
+  return NULL;
+}
+
+static int compare_entries(const void *a, const void *b) {
+  const combine_entry *x = a, *y = b;
+  int cmp = strcmp(x->mf.path, y->mf.path);
+  if (cmp != 0)
+    return cmp;
+  return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static void free_entry(media_file *mf) {
+  free(mf->path);
+  free(mf->filename);
+  if (mf->title)
+    free(mf->title);
+}
+
+//"out.m3u" becomes "out-001.m3u"
+static void part_name(const char *output, int part, char *out, size_t len) {
+  char base[PATH_MAX];
+  if (is_directory(output))
+    snprintf(base, sizeof(base), "%s/playlist.m3u", output);
+  else
+    snprintf(base, sizeof(base), "%s", output);
+
+  const char *slash = strrchr(base, '/');
+  const char *dot = strrchr(base, '.');
+  if (!dot || (slash && dot < slash) || dot == base)
+    snprintf(out, len, "%s-%03d", base, part);
+  else
+    snprintf(out, len, "%.*s-%03d%s", (int)(dot - base), base, part, dot);
+}
+
+static int write_parts(media_file mfs[], int count, const char *output,
+                       long max_entries, double max_duration, int verbose) {
+  if (max_entries <= 0 && max_duration <= 0)
+    return write_m3u(mfs, count, output, 0, NULL, NULL);
+
+  int part = 0;
+  int start = 0;
+  while (start < count) {
+    int end = start;
+    double total = 0;
+    while (end < count) {
+      double d = mfs[end].duration > 0 ? mfs[end].duration : 0;
+      //a part always takes at least one entry
+      if (end > start && ((max_entries > 0 && end - start >= max_entries) ||
+                          (max_duration > 0 && total + d > max_duration)))
+        break;
+      total += d;
+      end++;
+    }
+
+    char name[PATH_MAX + 16];
+    part_name(output, ++part, name, sizeof(name));
+    if (write_m3u(mfs + start, end - start, name, 0, NULL, NULL) != 0)
+      return -1;
+    if (verbose)
+      printf("Wrote %s (%d entries, %.0fs)\n", name, end - start, total);
+
+    start = end;
+  }
+  return 0;
+}
+
+//d2m3u combine: merge, dedupe and split playlists without probing
+int combine_main(int argc, char *argv[]) {
+  int flag_verbose = 0;
+  long max_entries = 0;
+  double max_duration = 0;
+  long jobs_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+  static struct option long_options[] = {
+      {"verbose", no_argument, 0, 'v'},
+      {"max-entries", required_argument, 0, 'n'},
+      {"max-duration", required_argument, 0, 't'},
+      {"jobs", required_argument, 0, 'j'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0}};
+
+  int opt;
+  int option_index = 0;
+  char *end;
+
+  //argv[0] is "combine" here
+  while ((opt = getopt_long(argc, argv, "vn:t:j:h", long_options,
+                            &option_index)) != -1) {
+    switch (opt) {
+    case 'v':
+      flag_verbose = 1;
+      break;
+    case 'n':
+      max_entries = strtol(optarg, &end, 10);
+      if (end == optarg || *end || max_entries <= 0) {
+        fprintf(stderr, "ERROR: Invalid entry limit %s.\n", optarg);
+        return -1;
+      }
+      break;
+    case 't':
+      max_duration = strtod(optarg, &end);
+      if (end == optarg || *end || max_duration <= 0) {
+        fprintf(stderr, "ERROR: Invalid duration limit %s.\n", optarg);
+        return -1;
+      }
+      break;
+    case 'j':
+      jobs_count = strtol(optarg, &end, 10);
+      if (end == optarg || *end || jobs_count <= 0) {
+        fprintf(stderr, "ERROR: Invalid job count %s.\n", optarg);
+        return -1;
+      }
+      break;
+    case 'h':
+      print_combine_usage("d2m3u");
+      return 0;
+    case '?':
+      fprintf(stderr, "Unknown option. Use combine -h for help.\n");
+      return -1;
+    }
+  }
+
+  if (argc - optind < 2) {
+    fprintf(stderr, "ERROR: Missing <output> or <playlist> argument. Use "
+                    "combine -h for help.\n");
+    return -1;
+  }
+
+  char *output = expand_path(argv[optind++]);
+  int npaths = argc - optind;
+
+  combine_jobs jobs = {.paths = &argv[optind], .npaths = npaths, .next = 0};
+  jobs.results = calloc(npaths, sizeof(media_file *));
+  jobs.counts = calloc(npaths, sizeof(int));
+  pthread_mutex_init(&jobs.lock, NULL);
+
+  if (jobs_count < 1)
+    jobs_count = 1;
+  if (jobs_count > COMBINE_MAX_JOBS)
+    jobs_count = COMBINE_MAX_JOBS;
+  if (jobs_count > npaths)
+    jobs_count = npaths;
+
+  pthread_t threads[COMBINE_MAX_JOBS];
+  int started = 0;
+  for (int i = 0; i < jobs_count; i++) {
+    if (pthread_create(&threads[i], NULL, combine_worker, &jobs) != 0)
+      break;
+    started++;
+  }
+  //no threads at all still works, just serially
+  if (started == 0)
+    combine_worker(&jobs);
+  for (int i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  pthread_mutex_destroy(&jobs.lock);
+
+  size_t total = 0;
+  int result = 0;
+  for (int i = 0; i < npaths; i++) {
+    if (jobs.counts[i] < 0)
+      result = -1;
+    else
+      total += jobs.counts[i];
+  }
+
+  combine_entry *entries = malloc((total ? total : 1) * sizeof(combine_entry));
+  media_file *mfs = malloc((total ? total : 1) * sizeof(media_file));
+  int count = 0;
+
+  if (result == 0 && entries && mfs) {
+    size_t seq = 0;
+    for (int i = 0; i < npaths; i++) {
+      for (int k = 0; k < jobs.counts[i]; k++) {
+        entries[seq].mf = jobs.results[i][k];
+        entries[seq].seq = seq;
+        seq++;
+      }
+      jobs.counts[i] = 0;
+    }
+
+    qsort(entries, total, sizeof(combine_entry), compare_entries);
+
+    //first occurrence wins, later ones only fill in an unknown duration
+    for (size_t i = 0; i < total; i++) {
+      media_file *mf = &entries[i].mf;
+      if (count > 0 && strcmp(mfs[count - 1].path, mf->path) == 0) {
+        media_file *kept = &mfs[count - 1];
+        if (kept->duration <= 0 && mf->duration > 0) {
+          kept->duration = mf->duration;
+          if (!kept->title) {
+            kept->title = mf->title;
+            mf->title = NULL;
+          }
+        }
+        free_entry(mf);
+        continue;
+      }
+      mfs[count++] = *mf;
+    }
+
+    if (flag_verbose)
+      printf("Read %zu entries from %d playlists, %d unique.\n", total,
+             npaths, count);
+
+    result = write_parts(mfs, count, output, max_entries, max_duration,
+                         flag_verbose);
+  }
+  else if (result == 0) {
+    perror("malloc");
+    result = -1;
+  }
+
+  for (int i = 0; i < npaths; i++) {
+    for (int k = 0; k < jobs.counts[i]; k++)
+      free_entry(&jobs.results[i][k]);
+    free(jobs.results[i]);
+  }
+  free(jobs.results);
+  free(jobs.counts);
+  free(entries);
+  free_media_files(mfs, count);
+  free(output);
+  return result;
+}
@@ -0,0 +1,12 @@
+//combine.h
+#ifndef COMBINE_H
+#define COMBINE_H
+
+#include "writem3u.h"
+
+#define COMBINE_MAX_JOBS 64
+
+int read_m3u(const char *path, media_file **out, int *out_count);
+int combine_main(int argc, char *argv[]);
+
+#endif //COMBINE_H
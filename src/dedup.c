@@ -0,0 +1,264 @@
+//dedup.c
+#include "dedup.h"
+#include "fileutils.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+  int idx;
+  off_t size;
+  dev_t dev;
+  ino_t ino;
+  uint64_t hash;
+  int hashed;
+  uint64_t confirm; //wider hash, see confirm_hash
+  int confirmed;
+} dedup_entry;
+
+int parse_dedup_mode(const char *arg) {
+  if (!arg || strcmp(arg, "collapse") == 0)
+    return DEDUP_COLLAPSE;
+  if (strcmp(arg, "copy") == 0)
+    return DEDUP_COPY;
+  return -1;
+}
+
+static uint64_t mix64(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+//word at a time, tail bytewise. not cryptographic, just fast
+static uint64_t hash_block(uint64_t h, const unsigned char *buf, size_t len) {
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t k;
+    memcpy(&k, buf + i, 8);
+    h ^= k * 0x9e3779b97f4a7c15ULL;
+    h = ((h << 31) | (h >> 33)) * 0xc2b2ae3d27d4eb4fULL;
+  }
+  for (; i < len; i++) {
+    h ^= buf[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static int read_block(int fd, unsigned char *buf, size_t len, off_t off) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t r = pread(fd, buf + done, len - done, off + done);
+    if (r <= 0)
+      return -1;
+    done += r;
+  }
+  return 0;
+}
+
+//hashes samples blocks spread evenly from head to tail, so 3 takes the
+//head, middle and tail. files that fit in that many blocks are hashed whole
+static int sample_hash(const char *path, off_t size, int samples,
+                       uint64_t *out) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  unsigned char *buf = malloc(DEDUP_SAMPLE_SIZE);
+  if (!buf) {
+    close(fd);
+    return -1;
+  }
+
+  uint64_t h = mix64((uint64_t)size);
+  int ret = 0;
+
+  if (size <= (off_t)DEDUP_SAMPLE_SIZE * samples) {
+    for (off_t off = 0; off < size && ret == 0; off += DEDUP_SAMPLE_SIZE) {
+      size_t len = size - off < DEDUP_SAMPLE_SIZE ? (size_t)(size - off)
+                                                  : DEDUP_SAMPLE_SIZE;
+      ret = read_block(fd, buf, len, off);
+      h = hash_block(h, buf, len);
+    }
+  }
+  else {
+    for (int i = 0; i < samples && ret == 0; i++) {
+      off_t off = (size - DEDUP_SAMPLE_SIZE) / (samples - 1) * i;
+      if (i == samples - 1)
+        off = size - DEDUP_SAMPLE_SIZE;
+      ret = read_block(fd, buf, DEDUP_SAMPLE_SIZE, off);
+      h = hash_block(h, buf, DEDUP_SAMPLE_SIZE);
+    }
+  }
+
+  free(buf);
+  close(fd);
+  *out = mix64(h);
+  return ret;
+}
+
+//second, wider look at a candidate. files up to DEDUP_FULL_HASH_MAX are
+//hashed whole, bigger ones at DEDUP_CONFIRM_SAMPLES points, so confirming
+//never reads more than a few probes worth of a multi-gb file
+static int confirm_hash(const char *path, off_t size, uint64_t *out) {
+  int samples = size <= DEDUP_FULL_HASH_MAX
+                    ? DEDUP_FULL_HASH_MAX / DEDUP_SAMPLE_SIZE
+                    : DEDUP_CONFIRM_SAMPLES;
+  return sample_hash(path, size, samples, out);
+}
+
+//marks the confirmed duplicates among n entries sharing a sampled hash,
+//ordered by index. returns how many were marked
+static int confirm_run(char *files[], dedup_entry *run, int n,
+                       int dup_of[]) {
+  for (int j = 0; j < n; j++) {
+    run[j].confirmed = 0;
+
+    //hard links share content, no need to read them twice
+    int linked = 0;
+    for (int k = 0; k < j && !linked; k++) {
+      if (run[k].dev == run[j].dev && run[k].ino == run[j].ino) {
+        run[j].confirm = run[k].confirm;
+        run[j].confirmed = run[k].confirmed;
+        linked = 1;
+      }
+    }
+
+    if (linked)
+      continue;
+
+    //the first pass already read small files whole
+    if (run[j].size <= (off_t)DEDUP_SAMPLE_SIZE * DEDUP_SAMPLES) {
+      run[j].confirm = run[j].hash;
+      run[j].confirmed = 1;
+    }
+    else {
+      run[j].confirmed = confirm_hash(files[run[j].idx], run[j].size,
+                                      &run[j].confirm) == 0;
+    }
+  }
+
+  int dups = 0;
+  for (int j = 1; j < n; j++) {
+    if (!run[j].confirmed)
+      continue;
+
+    for (int k = 0; k < j; k++) {
+      if (run[k].confirmed && dup_of[run[k].idx] == -1 &&
+          run[k].confirm == run[j].confirm) {
+        dup_of[run[j].idx] = run[k].idx;
+        dups++;
+        break;
+      }
+    }
+  }
+  return dups;
+}
+
+static int compare_by_inode(const void *a, const void *b) {
+  const dedup_entry *x = a, *y = b;
+  if (x->size != y->size)
+    return x->size < y->size ? -1 : 1;
+  if (x->dev != y->dev)
+    return x->dev < y->dev ? -1 : 1;
+  if (x->ino != y->ino)
+    return x->ino < y->ino ? -1 : 1;
+  return x->idx - y->idx;
+}
+
+static int compare_by_hash(const void *a, const void *b) {
+  const dedup_entry *x = a, *y = b;
+  if (x->hashed != y->hashed)
+    return y->hashed - x->hashed;
+  if (x->hash != y->hash)
+    return x->hash < y->hash ? -1 : 1;
+  return x->idx - y->idx;
+}
+
+//dup_of[i] is the index of the file i duplicates, or -1 if it is unique or
+//the representative of its group. representatives are always the lowest
+//index, so they come first in the (sorted) input order
+int find_duplicates(char *files[], int n, int dup_of[]) {
+  dedup_entry *entries = malloc(n * sizeof(dedup_entry));
+  if (!entries) {
+    perror("malloc");
+    return -1;
+  }
+
+  int count = 0;
+  for (int i = 0; i < n; i++) {
+    dup_of[i] = -1;
+
+    struct stat st;
+    if (is_web_url(files[i]) || stat(files[i], &st) != 0 ||
+        !S_ISREG(st.st_mode))
+      continue;
+
+    entries[count].idx = i;
+    entries[count].size = st.st_size;
+    entries[count].dev = st.st_dev;
+    entries[count].ino = st.st_ino;
+    entries[count].hashed = 0;
+    count++;
+  }
+
+  qsort(entries, count, sizeof(dedup_entry), compare_by_inode);
+
+  int dups = 0;
+  int start = 0;
+  while (start < count) {
+    int end = start + 1;
+    while (end < count && entries[end].size == entries[start].size)
+      end++;
+
+    //only groups of equal size can hold duplicates
+    if (end - start > 1) {
+      for (int j = start; j < end; j++) {
+        //hard links share content, no need to read them twice
+        if (j > start && entries[j].dev == entries[j - 1].dev &&
+            entries[j].ino == entries[j - 1].ino) {
+          entries[j].hash = entries[j - 1].hash;
+          entries[j].hashed = entries[j - 1].hashed;
+        }
+        else {
+          entries[j].hashed = sample_hash(files[entries[j].idx],
+                                          entries[j].size, DEDUP_SAMPLES,
+                                          &entries[j].hash) == 0;
+        }
+      }
+
+      qsort(entries + start, end - start, sizeof(dedup_entry),
+            compare_by_hash);
+
+      //equal hashes are adjacent now, lowest index first. a match is only
+      //a candidate, files that differ outside the sampled blocks hash the
+      //same, so each run is confirmed with a wider hash read once per file
+      int run = start;
+      for (int j = start + 1; j <= end; j++) {
+        if (j < end && entries[j].hashed &&
+            entries[j].hash == entries[run].hash)
+          continue;
+
+        if (j - run > 1)
+          dups += confirm_run(files, entries + run, j - run, dup_of);
+
+        if (j < end && !entries[j].hashed)
+          break;
+        run = j;
+      }
+    }
+
+    start = end;
+  }
+
+  free(entries);
+  return dups;
+}
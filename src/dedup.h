@@ -0,0 +1,17 @@
+//dedup.h
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#define DEDUP_OFF 0
+#define DEDUP_COLLAPSE 1 //drop duplicates from the playlist
+#define DEDUP_COPY 2     //keep duplicates, reuse the representative's probe
+
+#define DEDUP_SAMPLE_SIZE 65536 //64kb per sampled block
+#define DEDUP_SAMPLES 3         //head, middle, tail
+#define DEDUP_CONFIRM_SAMPLES 16 //blocks read to confirm a big candidate
+#define DEDUP_FULL_HASH_MAX 4194304 //4mb, smaller candidates are read whole
+
+int parse_dedup_mode(const char *arg);
+int find_duplicates(char *files[], int n, int dup_of[]);
+
+#endif //DEDUP_H
@@ -1,9 +1,12 @@
 //fileutils.c
 #include "fileutils.h"
+#include "listcache.h"
 #include <ctype.h>
 #include <curl/curl.h>
 #include <dirent.h>
+#include <errno.h>
 #include <fts.h>
+#include <limits.h>
 #include <pwd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -73,6 +76,17 @@ int scan_directory(const char *input, char *files[]) {
   return file_count;
 }
 
+//64 bit fnv-1a. stable across runs and machines, used to name cache files
+//and to split files between shards
+uint64_t fnv1a_hash(const char *s) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (; *s; s++) {
+    h ^= (unsigned char)*s;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
 char *expand_path(const char *path) {
   if (path[0] == '~') {
     const char *home = getenv("HOME");
@@ -97,6 +111,86 @@ char *expand_path(const char *path) {
   }
 }
 
+//opens path for replacing it atomically: a uniquely named temp file next
+//to it, renamed over it by replace_file_commit. symlinks are resolved
+//first so the link survives, and the temp file takes over the old mode
+//and owner. anything that is not a plain, singly linked regular file
+//(stdout, a fifo, a device, a hard linked playlist) is written in place
+//instead, tmppath is left empty then. target and tmppath need PATH_MAX
+//and REPLACE_TMP_MAX bytes
+FILE *replace_file_open(const char *path, char *target, char *tmppath) {
+  tmppath[0] = '\0';
+
+  struct stat st;
+  int exists = 1;
+  if (!realpath(path, target)) {
+    if (errno != ENOENT) {
+      perror(path);
+      return NULL;
+    }
+    strncpy(target, path, PATH_MAX);
+    target[PATH_MAX - 1] = '\0';
+    //a dangling symlink is written through, creating what it points at
+    exists = lstat(target, &st) == 0;
+  }
+  else if (stat(target, &st) != 0) {
+    exists = 0;
+  }
+
+  if (exists && (!S_ISREG(st.st_mode) || st.st_nlink > 1)) {
+    FILE *fp = fopen(target, "w");
+    if (!fp)
+      perror(target);
+    return fp;
+  }
+
+  snprintf(tmppath, REPLACE_TMP_MAX, "%s.XXXXXX", target);
+  int fd = mkstemp(tmppath);
+  if (fd < 0) {
+    perror(tmppath);
+    return NULL;
+  }
+
+  //mkstemp creates 0600, new files get what fopen would have given them
+  if (exists) {
+    fchmod(fd, st.st_mode & 07777);
+    //only root can give it away, for anyone else it is already theirs
+    if (fchown(fd, st.st_uid, st.st_gid) != 0 && errno != EPERM)
+      perror("fchown");
+  }
+  else {
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+  }
+
+  FILE *fp = fdopen(fd, "w");
+  if (!fp) {
+    perror("fdopen");
+    close(fd);
+    unlink(tmppath);
+    tmppath[0] = '\0';
+  }
+  return fp;
+}
+
+int replace_file_commit(FILE *fp, const char *tmppath, const char *target) {
+  if (!tmppath[0]) {
+    if (fclose(fp) != 0) {
+      perror(target);
+      return -1;
+    }
+    return 0;
+  }
+
+  if (fclose(fp) != 0 || rename(tmppath, target) != 0) {
+    perror(tmppath);
+    unlink(tmppath);
+    return -1;
+  }
+  return 0;
+}
+
 static size_t write_memory_callback(void *contents, size_t size, size_t nmemb,
                                     void *userp) {
   size_t realsize = size * nmemb;
@@ -116,6 +210,45 @@ static size_t write_memory_callback(void *contents, size_t size, size_t nmemb,
   return realsize;
 }
 
+//keeps the validators of the final response, redirects reset them
+static size_t header_callback(char *buffer, size_t size, size_t nitems,
+                              void *userp) {
+  size_t realsize = size * nitems;
+  listing_cache_entry *validators = (listing_cache_entry *)userp;
+
+  const char *value = NULL;
+  char **field = NULL;
+
+  if (realsize > 5 && strncmp(buffer, "HTTP/", 5) == 0) {
+    free(validators->etag);
+    free(validators->last_modified);
+    validators->etag = NULL;
+    validators->last_modified = NULL;
+    return realsize;
+  }
+  if (realsize > 5 && strncasecmp(buffer, "ETag:", 5) == 0) {
+    value = buffer + 5;
+    field = &validators->etag;
+  }
+  else if (realsize > 14 && strncasecmp(buffer, "Last-Modified:", 14) == 0) {
+    value = buffer + 14;
+    field = &validators->last_modified;
+  }
+  else {
+    return realsize;
+  }
+
+  const char *end = buffer + realsize;
+  while (value < end && isspace((unsigned char)*value))
+    value++;
+  while (end > value && isspace((unsigned char)end[-1]))
+    end--;
+
+  free(*field);
+  *field = strndup(value, end - value);
+  return realsize;
+}
+
 char *extract_auth_from_url(const char *url, char **clean_url, char **username,
                             char **password) {
   *username = NULL;
@@ -161,8 +294,8 @@ char *extract_auth_from_url(const char *url, char **clean_url, char **username,
   return *clean_url;
 }
 
-static int parse_apache_listing(const char *html, const char *base_url,
-                                char *files[], int max_files) {
+int parse_apache_listing(const char *html, const char *base_url, char *files[],
+                         int max_files) {
   int count = 0;
   const char *ptr = html;
 
@@ -201,8 +334,8 @@ static int parse_apache_listing(const char *html, const char *base_url,
   return count;
 }
 
-static int parse_nginx_listing(const char *html, const char *base_url,
-                               char *files[], int max_files) {
+int parse_nginx_listing(const char *html, const char *base_url, char *files[],
+                        int max_files) {
   int count = 0;
   const char *ptr = html;
 
@@ -247,8 +380,8 @@ static int parse_nginx_listing(const char *html, const char *base_url,
 }
 
 //json (untested rn)
-static int parse_json_listing(const char *json, const char *base_url,
-                              char *files[], int max_files) {
+int parse_json_listing(const char *json, const char *base_url, char *files[],
+                       int max_files) {
   int count = 0;
   const char *ptr = json;
 
@@ -295,12 +428,31 @@ static int parse_json_listing(const char *json, const char *base_url,
   return count;
 }
 
+//tries each listing format in turn
+int parse_listing(const char *body, const char *base_url, char *files[],
+                  int max_files) {
+  int count = parse_apache_listing(body, base_url, files, max_files);
+
+  if (count == 0) {
+    count = parse_nginx_listing(body, base_url, files, max_files);
+  }
+
+  if (count == 0) {
+    count = parse_json_listing(body, base_url, files, max_files);
+  }
+
+  return count;
+}
+
 int scan_web_directory(const char *url, char *files[], const char *username,
-                       const char *password) {
+                       const char *password, const char *cache_dir) {
   CURL *curl;
   CURLcode res;
   struct MemoryStruct chunk;
   int file_count = 0;
+  listing_cache_entry cached = {0};
+  listing_cache_entry validators = {0};
+  struct curl_slist *headers = NULL;
 
   chunk.memory = malloc(1);
   chunk.size = 0;
@@ -337,6 +489,28 @@ int scan_web_directory(const char *url, char *files[], const char *username,
     curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
   }
 
+  //revalidate a cached listing instead of downloading it again
+  int have_cache =
+      cache_dir && listing_cache_load(cache_dir, clean_url, &cached) == 0;
+  if (have_cache) {
+    char header[1024];
+    if (cached.etag) {
+      snprintf(header, sizeof(header), "If-None-Match: %s", cached.etag);
+      headers = curl_slist_append(headers, header);
+    }
+    if (cached.last_modified) {
+      snprintf(header, sizeof(header), "If-Modified-Since: %s",
+               cached.last_modified);
+      headers = curl_slist_append(headers, header);
+    }
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  }
+
+  if (cache_dir) {
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)&validators);
+  }
+
   res = curl_easy_perform(curl);
 
   if (res != CURLE_OK) {
@@ -349,18 +523,7 @@ int scan_web_directory(const char *url, char *files[], const char *username,
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
 
     if (response_code == 200) {
-      file_count =
-          parse_apache_listing(chunk.memory, clean_url, files, MAX_FILES);
-
-      if (file_count == 0) {
-        file_count =
-            parse_nginx_listing(chunk.memory, clean_url, files, MAX_FILES);
-      }
-
-      if (file_count == 0) {
-        file_count =
-            parse_json_listing(chunk.memory, clean_url, files, MAX_FILES);
-      }
+      file_count = parse_listing(chunk.memory, clean_url, files, MAX_FILES);
 
       if (file_count > 0) {
         qsort(files, file_count, sizeof(char *), compare_files);
@@ -368,6 +531,23 @@ int scan_web_directory(const char *url, char *files[], const char *username,
       else {
         fprintf(stderr, "No media files found in directory listing\n");
       }
+
+      if (cache_dir) {
+        validators.entries = files;
+        validators.count = file_count;
+        listing_cache_store(cache_dir, clean_url, &validators);
+        validators.entries = NULL;
+        validators.count = 0;
+      }
+    }
+    else if (response_code == 304 && have_cache) {
+      //unchanged since the cached listing
+      for (int i = 0; i < cached.count && file_count < MAX_FILES; i++) {
+        files[file_count++] = strdup(cached.entries[i]);
+      }
+      if (file_count == 0) {
+        fprintf(stderr, "No media files found in directory listing\n");
+      }
     }
     else if (response_code == 401) {
       fprintf(stderr, "Authentication failed (401 Unauthorized)\n");
@@ -381,6 +561,9 @@ int scan_web_directory(const char *url, char *files[], const char *username,
 
   curl_easy_cleanup(curl);
   curl_global_cleanup();
+  curl_slist_free_all(headers);
+  listing_cache_free(&cached);
+  listing_cache_free(&validators);
 
   free(chunk.memory);
   free(clean_url);
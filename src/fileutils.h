@@ -2,9 +2,13 @@
 #ifndef FILEUTILS_H
 #define FILEUTILS_H
 
+#include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 #define MAX_FILES 2048
+#define REPLACE_TMP_MAX (PATH_MAX + 8) //target plus ".XXXXXX"
 
 struct MemoryStruct {
   char *memory;
@@ -16,9 +20,20 @@ int compare_files(const void *a, const void *b);
 int is_directory(const char *path);
 int scan_directory(const char *input, char *files[]);
 char *expand_path(const char *path);
+uint64_t fnv1a_hash(const char *s);
+FILE *replace_file_open(const char *path, char *target, char *tmppath);
+int replace_file_commit(FILE *fp, const char *tmppath, const char *target);
 int is_web_url(const char *path);
 int scan_web_directory(const char *url, char *files[], const char *username,
-                       const char *password);
+                       const char *password, const char *cache_dir);
+int parse_apache_listing(const char *html, const char *base_url, char *files[],
+                         int max_files);
+int parse_nginx_listing(const char *html, const char *base_url, char *files[],
+                        int max_files);
+int parse_json_listing(const char *json, const char *base_url, char *files[],
+                       int max_files);
+int parse_listing(const char *body, const char *base_url, char *files[],
+                  int max_files);
 char *extract_auth_from_url(const char *url, char **clean_url, char **username,
                             char **password);
 
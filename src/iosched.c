@@ -0,0 +1,140 @@
+//iosched.c
+#include "iosched.h"
+#include "fileutils.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+typedef struct {
+  int idx;
+  int local;
+  dev_t dev;
+  int has_phys;
+  uint64_t key; //physical offset of the first extent, else inode
+} probe_slot;
+
+#ifdef __linux__
+static int first_extent(int fd, uint64_t *phys) {
+  union {
+    struct fiemap map;
+    char buf[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+  } req;
+
+  memset(&req, 0, sizeof(req));
+  req.map.fm_start = 0;
+  req.map.fm_length = FIEMAP_MAX_OFFSET;
+  req.map.fm_extent_count = 1;
+
+  if (ioctl(fd, FS_IOC_FIEMAP, &req.map) != 0 ||
+      req.map.fm_mapped_extents == 0)
+    return -1;
+
+  //inline/delalloc extents have no meaningful physical address yet
+  if (req.map.fm_extents[0].fe_flags &
+      (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE))
+    return -1;
+
+  *phys = req.map.fm_extents[0].fe_physical;
+  return 0;
+}
+#endif
+
+static void locate(const char *path, probe_slot *slot) {
+  slot->local = 0;
+  slot->has_phys = 0;
+
+  if (is_web_url(path))
+    return;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0) {
+    slot->local = 1;
+    slot->dev = st.st_dev;
+    slot->key = st.st_ino;
+#ifdef __linux__
+    uint64_t phys;
+    if (first_extent(fd, &phys) == 0) {
+      slot->key = phys;
+      slot->has_phys = 1;
+    }
+#endif
+  }
+
+  close(fd);
+}
+
+static int compare_slots(const void *a, const void *b) {
+  const probe_slot *x = a, *y = b;
+  //local files first, web files keep their order
+  if (x->local != y->local)
+    return y->local - x->local;
+  if (x->local) {
+    if (x->dev != y->dev)
+      return x->dev < y->dev ? -1 : 1;
+    if (x->has_phys != y->has_phys)
+      return y->has_phys - x->has_phys;
+    if (x->key != y->key)
+      return x->key < y->key ? -1 : 1;
+  }
+  return x->idx - y->idx;
+}
+
+//sorts the n indexes of files[] in order[] into the order they sit on
+//disk, so the probe sweeps the platter instead of seeking back and forth.
+//callers pass only the files that will really be probed
+void plan_probe_order(char *files[], int order[], int n) {
+  probe_slot *slots = malloc(n * sizeof(probe_slot));
+  if (!slots)
+    return;
+
+  for (int i = 0; i < n; i++) {
+    slots[i].idx = order[i];
+    locate(files[order[i]], &slots[i]);
+  }
+
+  qsort(slots, n, sizeof(probe_slot), compare_slots);
+
+  for (int i = 0; i < n; i++)
+    order[i] = slots[i].idx;
+
+  free(slots);
+}
+
+static void prefetch_file(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return;
+
+  //only queues the read, the pages stay cached after close
+#if defined(__APPLE__)
+  struct radvisory ra = {.ra_offset = 0, .ra_count = READAHEAD_SIZE};
+  fcntl(fd, F_RDADVISE, &ra);
+#else
+  posix_fadvise(fd, 0, READAHEAD_SIZE, POSIX_FADV_WILLNEED);
+#endif
+
+  close(fd);
+}
+
+//prefetches the headers of order[from..from+count), skipping web files
+void prefetch_headers(char *files[], const int order[], int n, int from,
+                      int count) {
+  for (int k = from; k < from + count && k < n; k++) {
+    if (!is_web_url(files[order[k]]))
+      prefetch_file(files[order[k]]);
+  }
+}
@@ -0,0 +1,12 @@
+//iosched.h
+#ifndef IOSCHED_H
+#define IOSCHED_H
+
+#define READAHEAD_FILES 4      //headers prefetched ahead of the probe
+#define READAHEAD_SIZE 1000000 //1mb, matches PROBE_SIZE
+
+void plan_probe_order(char *files[], int order[], int n);
+void prefetch_headers(char *files[], const int order[], int n, int from,
+                      int count);
+
+#endif //IOSCHED_H
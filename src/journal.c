@@ -0,0 +1,295 @@
+//journal.c
+#include "journal.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//one record per line: duration \t path \t filename \t title
+//tabs, newlines and backslashes inside fields are escaped
+
+static void write_escaped(FILE *fp, const char *s) {
+  for (; s && *s; s++) {
+    switch (*s) {
+    case '\\':
+      fputs("\\\\", fp);
+      break;
+    case '\t':
+      fputs("\\t", fp);
+      break;
+    case '\n':
+      fputs("\\n", fp);
+      break;
+    case '\r':
+      fputs("\\r", fp);
+      break;
+    default:
+      fputc(*s, fp);
+    }
+  }
+}
+
+//unescapes the field starting at s in place, returns the next field or NULL
+static char *next_field(char *s) {
+  char *out = s;
+  for (; *s && *s != '\t'; s++) {
+    if (*s == '\\' && s[1]) {
+      s++;
+      *out++ = *s == 't' ? '\t' : *s == 'n' ? '\n' : *s == 'r' ? '\r' : *s;
+    }
+    else {
+      *out++ = *s;
+    }
+  }
+  char *next = *s == '\t' ? s + 1 : NULL;
+  *out = '\0';
+  return next;
+}
+
+static int parse_record(char *line, media_file *mf) {
+  char *path = strchr(line, '\t');
+  if (!path)
+    return -1;
+  *path++ = '\0';
+
+  char *end;
+  double duration = strtod(line, &end);
+  if (end == line)
+    return -1;
+
+  char *filename = next_field(path);
+  if (!filename)
+    return -1;
+  char *title = next_field(filename);
+  if (!title)
+    return -1;
+  next_field(title);
+
+  mf->path = strdup(path);
+  mf->filename = strdup(filename);
+  mf->duration = duration;
+  mf->title = *title ? strdup(title) : NULL;
+  return 0;
+}
+
+static int compare_records(const void *a, const void *b) {
+  return strcmp(((const media_file *)a)->path, ((const media_file *)b)->path);
+}
+
+//reads back every complete record. a torn last line from a crash is cut
+//off so new records start on a fresh line
+static int journal_load(journal *jr, int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    return -1;
+  if (st.st_size == 0)
+    return 0;
+
+  char *data = malloc(st.st_size + 1);
+  if (!data)
+    return -1;
+
+  size_t size = 0;
+  while (size < (size_t)st.st_size) {
+    ssize_t r = pread(fd, data + size, st.st_size - size, size);
+    if (r <= 0)
+      break;
+    size += r;
+  }
+  if (size < (size_t)st.st_size) {
+    perror(jr->path);
+    free(data);
+    return -1;
+  }
+  data[size] = '\0';
+
+  size_t header_len = strlen(JOURNAL_HEADER);
+  if (size < header_len + 1 || strncmp(data, JOURNAL_HEADER, header_len) != 0 ||
+      data[header_len] != '\n') {
+    fprintf(stderr, "ERROR: %s is not a d2m3u journal.\n", jr->path);
+    free(data);
+    return -1;
+  }
+
+  int capacity = 64;
+  jr->records = malloc(capacity * sizeof(media_file));
+  if (!jr->records) {
+    perror("malloc");
+    free(data);
+    return -1;
+  }
+
+  char *line = data + header_len + 1;
+  char *nl;
+
+  while ((nl = strchr(line, '\n')) != NULL) {
+    *nl = '\0';
+    if (jr->count == capacity) {
+      capacity *= 2;
+      media_file *grown = realloc(jr->records, capacity * sizeof(media_file));
+      if (!grown) {
+        //the unread records are still good, leave the file alone
+        perror("realloc");
+        free(data);
+        return -1;
+      }
+      jr->records = grown;
+    }
+    if (parse_record(line, &jr->records[jr->count]) == 0)
+      jr->count++;
+    line = nl + 1;
+  }
+
+  //only reached once every newline is consumed, so anything left is torn
+  if (line - data < (long)size && ftruncate(fd, line - data) != 0)
+    perror("ftruncate");
+
+  free(data);
+  qsort(jr->records, jr->count, sizeof(media_file), compare_records);
+  return 0;
+}
+
+//opens path for appending. with resume the existing records are loaded
+//first, otherwise any old journal is replaced
+int journal_open(journal *jr, const char *path, int resume) {
+  memset(jr, 0, sizeof(*jr));
+  jr->path = strdup(path);
+
+  int fd = open(path, O_RDWR | O_CREAT | (resume ? 0 : O_TRUNC), 0644);
+  if (fd < 0) {
+    perror("open");
+    journal_close(jr, 0);
+    return -1;
+  }
+
+  if (resume && journal_load(jr, fd) != 0) {
+    close(fd);
+    journal_close(jr, 0);
+    return -1;
+  }
+
+  struct stat st;
+  int empty = fstat(fd, &st) == 0 && st.st_size == 0;
+
+  jr->fp = fdopen(fd, "a");
+  if (!jr->fp) {
+    perror("fdopen");
+    close(fd);
+    journal_close(jr, 0);
+    return -1;
+  }
+
+  if (empty) {
+    fprintf(jr->fp, "%s\n", JOURNAL_HEADER);
+    fflush(jr->fp);
+  }
+
+  return 0;
+}
+
+//starts a journal on a stream the caller opened and will close, for
+//writers that manage the file themselves. journal_close is not used then
+void journal_attach(journal *jr, FILE *fp) {
+  memset(jr, 0, sizeof(*jr));
+  jr->fp = fp;
+  fprintf(fp, "%s\n", JOURNAL_HEADER);
+}
+
+//copies a replayed result for path into mf. returns 1 if found
+int journal_lookup(const journal *jr, const char *path, media_file *mf) {
+  if (!jr || jr->count == 0)
+    return 0;
+
+  media_file key = {.path = (char *)path};
+  const media_file *rec =
+      bsearch(&key, jr->records, jr->count, sizeof(media_file),
+              compare_records);
+  if (!rec)
+    return 0;
+
+  mf->path = strdup(rec->path);
+  mf->filename = strdup(rec->filename);
+  mf->duration = rec->duration;
+  mf->title = rec->title ? strdup(rec->title) : NULL;
+  return 1;
+}
+
+//flushed per record so a killed process loses nothing, synced in batches
+int journal_append(journal *jr, const media_file *mf) {
+  if (!jr || !jr->fp)
+    return 0;
+
+  fprintf(jr->fp, "%.3f\t", mf->duration);
+  write_escaped(jr->fp, mf->path);
+  fputc('\t', jr->fp);
+  write_escaped(jr->fp, mf->filename);
+  fputc('\t', jr->fp);
+  write_escaped(jr->fp, mf->title);
+  fputc('\n', jr->fp);
+
+  if (fflush(jr->fp) != 0) {
+    perror("journal");
+    return -1;
+  }
+
+  if (++jr->unsynced >= JOURNAL_SYNC_EVERY) {
+    fsync(fileno(jr->fp));
+    jr->unsynced = 0;
+  }
+  return 0;
+}
+
+void journal_close(journal *jr, int remove_file) {
+  if (jr->fp) {
+    fflush(jr->fp);
+    fsync(fileno(jr->fp));
+    fclose(jr->fp);
+  }
+  if (remove_file && jr->path)
+    unlink(jr->path);
+
+  if (jr->records)
+    free_media_files(jr->records, jr->count);
+  free(jr->path);
+  memset(jr, 0, sizeof(*jr));
+}
+
+int journal_reader_open(journal_reader *rd, const char *path) {
+  memset(rd, 0, sizeof(*rd));
+
+  rd->fp = fopen(path, "r");
+  if (!rd->fp) {
+    perror(path);
+    return -1;
+  }
+
+  ssize_t len = getline(&rd->line, &rd->cap, rd->fp);
+  if (len <= 0 || strcmp(rd->line, JOURNAL_HEADER "\n") != 0) {
+    fprintf(stderr, "ERROR: %s is not a d2m3u journal.\n", path);
+    journal_reader_close(rd);
+    return -1;
+  }
+  return 0;
+}
+
+//reads the next complete record into mf. returns 1, or 0 at the end
+int journal_read(journal_reader *rd, media_file *mf) {
+  ssize_t len;
+  while ((len = getline(&rd->line, &rd->cap, rd->fp)) > 0) {
+    //torn last record
+    if (rd->line[len - 1] != '\n')
+      return 0;
+    rd->line[len - 1] = '\0';
+    if (parse_record(rd->line, mf) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+void journal_reader_close(journal_reader *rd) {
+  if (rd->fp)
+    fclose(rd->fp);
+  free(rd->line);
+  memset(rd, 0, sizeof(*rd));
+}
@@ -0,0 +1,36 @@
+//journal.h
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "writem3u.h"
+#include <stdio.h>
+
+#define JOURNAL_HEADER "#D2M3U-JOURNAL 1"
+#define JOURNAL_SYNC_EVERY 32 //records between fsyncs
+
+struct journal {
+  FILE *fp;
+  char *path;
+  int unsynced;
+  media_file *records; //replayed on resume, sorted by path
+  int count;
+};
+
+//sequential reader, used to merge shard results
+typedef struct {
+  FILE *fp;
+  char *line;
+  size_t cap;
+} journal_reader;
+
+int journal_open(journal *jr, const char *path, int resume);
+void journal_attach(journal *jr, FILE *fp);
+int journal_lookup(const journal *jr, const char *path, media_file *mf);
+int journal_append(journal *jr, const media_file *mf);
+void journal_close(journal *jr, int remove_file);
+
+int journal_reader_open(journal_reader *rd, const char *path);
+int journal_read(journal_reader *rd, media_file *mf);
+void journal_reader_close(journal_reader *rd);
+
+#endif //JOURNAL_H
@@ -0,0 +1,167 @@
+//listcache.c
+#include "listcache.h"
+#include "fileutils.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//file layout: header, "url", "etag" and "last-modified" lines, then one
+//entry url per line
+
+char *default_cache_dir(void) {
+  char path[PATH_MAX];
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+
+  if (xdg && *xdg)
+    snprintf(path, sizeof(path), "%s/d2m3u", xdg);
+  else if (home && *home)
+    snprintf(path, sizeof(path), "%s/.cache/d2m3u", home);
+  else
+    return NULL;
+
+  return strdup(path);
+}
+
+static void cache_file_path(const char *dir, const char *url, char *out,
+                            size_t out_len) {
+  //the url itself is stored inside to rule out collisions
+  snprintf(out, out_len, "%s/%016llx.listing", dir,
+           (unsigned long long)fnv1a_hash(url));
+}
+
+static void strip_newline(char *line) {
+  line[strcspn(line, "\r\n")] = '\0';
+}
+
+//returns 0 and fills entry if a listing for url is cached
+int listing_cache_load(const char *dir, const char *url,
+                       listing_cache_entry *entry) {
+  memset(entry, 0, sizeof(*entry));
+
+  char path[PATH_MAX];
+  cache_file_path(dir, url, path, sizeof(path));
+
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    return -1;
+
+  char *line = NULL;
+  size_t cap = 0;
+  int ok = 0;
+
+  if (getline(&line, &cap, fp) > 0) {
+    strip_newline(line);
+    ok = strcmp(line, LISTING_CACHE_HEADER) == 0;
+  }
+  if (ok && getline(&line, &cap, fp) > 0) {
+    strip_newline(line);
+    ok = strncmp(line, "url ", 4) == 0 && strcmp(line + 4, url) == 0;
+  }
+  else {
+    ok = 0;
+  }
+
+  int capacity = 0;
+  while (ok && getline(&line, &cap, fp) > 0) {
+    strip_newline(line);
+    if (strncmp(line, "etag ", 5) == 0) {
+      free(entry->etag);
+      entry->etag = strdup(line + 5);
+    }
+    else if (strncmp(line, "last-modified ", 14) == 0) {
+      free(entry->last_modified);
+      entry->last_modified = strdup(line + 14);
+    }
+    else if (*line) {
+      if (entry->count == capacity) {
+        capacity = capacity ? capacity * 2 : 64;
+        char **grown = realloc(entry->entries, capacity * sizeof(char *));
+        if (!grown) {
+          ok = 0;
+          break;
+        }
+        entry->entries = grown;
+      }
+      entry->entries[entry->count++] = strdup(line);
+    }
+  }
+
+  free(line);
+  fclose(fp);
+
+  //nothing to revalidate against
+  if (ok && !entry->etag && !entry->last_modified)
+    ok = 0;
+
+  if (!ok) {
+    listing_cache_free(entry);
+    return -1;
+  }
+  return 0;
+}
+
+static int make_dir(const char *dir) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s", dir);
+
+  for (char *p = path + 1; *p; p++) {
+    if (*p == '/') {
+      *p = '\0';
+      if (mkdir(path, 0755) != 0 && errno != EEXIST)
+        return -1;
+      *p = '/';
+    }
+  }
+  if (mkdir(path, 0755) != 0 && errno != EEXIST)
+    return -1;
+  return 0;
+}
+
+//replaces the cached listing for url. listings without validators can't
+//be revalidated and are not stored
+int listing_cache_store(const char *dir, const char *url,
+                        const listing_cache_entry *entry) {
+  if (!entry->etag && !entry->last_modified)
+    return 0;
+
+  if (make_dir(dir) != 0) {
+    perror(dir);
+    return -1;
+  }
+
+  //nodes sharing a cache dir may store the same listing at once, each
+  //writes its own temp file and the last rename wins
+  char path[PATH_MAX];
+  char target[PATH_MAX];
+  char tmppath[REPLACE_TMP_MAX];
+  cache_file_path(dir, url, path, sizeof(path));
+
+  FILE *fp = replace_file_open(path, target, tmppath);
+  if (!fp)
+    return -1;
+
+  fprintf(fp, "%s\nurl %s\n", LISTING_CACHE_HEADER, url);
+  if (entry->etag)
+    fprintf(fp, "etag %s\n", entry->etag);
+  if (entry->last_modified)
+    fprintf(fp, "last-modified %s\n", entry->last_modified);
+  for (int i = 0; i < entry->count; i++)
+    fprintf(fp, "%s\n", entry->entries[i]);
+
+  return replace_file_commit(fp, tmppath, target);
+}
+
+void listing_cache_free(listing_cache_entry *entry) {
+  for (int i = 0; i < entry->count; i++)
+    free(entry->entries[i]);
+  free(entry->entries);
+  free(entry->etag);
+  free(entry->last_modified);
+  memset(entry, 0, sizeof(*entry));
+}
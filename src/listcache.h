@@ -0,0 +1,22 @@
+//listcache.h
+#ifndef LISTCACHE_H
+#define LISTCACHE_H
+
+#define LISTING_CACHE_HEADER "#D2M3U-LISTING 1"
+
+//parsed listing of one url plus the validators it was served with
+typedef struct {
+  char *etag;
+  char *last_modified;
+  char **entries;
+  int count;
+} listing_cache_entry;
+
+char *default_cache_dir(void);
+int listing_cache_load(const char *dir, const char *url,
+                       listing_cache_entry *entry);
+int listing_cache_store(const char *dir, const char *url,
+                        const listing_cache_entry *entry);
+void listing_cache_free(listing_cache_entry *entry);
+
+#endif //LISTCACHE_H
@@ -1,35 +1,100 @@
+#include "combine.h"
+#include "dedup.h"
 #include "fileutils.h"
+#include "journal.h"
+#include "listcache.h"
+#include "shard.h"
+#include "webdav.h"
 #include "writem3u.h"
 #include <getopt.h>
 #include <libavformat/avformat.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 void print_usage(const char *name);
 
+static void handle_sigint(int sig) {
+  (void)sig;
+  probe_interrupted = 1;
+}
+
+//shard runs write a result file for --merge instead of a playlist. files
+//backfill failed to probe are left out, as a run without a deadline would
+static int write_output(media_file mfs[], int count, const char *filename,
+                        int shard_count, int embed_auth, const char *username,
+                        const char *password) {
+  media_file *kept = malloc((count ? count : 1) * sizeof(media_file));
+  if (!kept) {
+    perror("malloc");
+    return -1;
+  }
+
+  //shallow copies, mfs keeps ownership
+  int kept_count = 0;
+  for (int i = 0; i < count; i++) {
+    if (mfs[i].duration != DURATION_FAILED)
+      kept[kept_count++] = mfs[i];
+  }
+
+  int result;
+  if (shard_count > 0)
+    result = write_shard(kept, kept_count, filename);
+  else
+    result = write_m3u(kept, kept_count, filename, embed_auth, username,
+                       password);
+
+  free(kept);
+  return result;
+}
+
 int main(int argc, char *argv[]) {
   int flag_verbose = 0;
   int flag_8 = 0; //unused currently. to determine unicode-8 (m3u8) encoding
   int flag_embed_auth = 0;
+  int dedup_mode = DEDUP_OFF;
+  int flag_resume = 0;
+  int flag_backfill = 0;
+  int flag_webdav = 0;
+  double deadline = 0;
+  int shard_index = 0;
+  int shard_count = 0;
+  const char *merge_output = NULL;
+  const char *journal_path = NULL;
+  char *cache_dir = NULL;
   const char *input = NULL;
   const char *output_filename = NULL;
   char *username = NULL;
   char *password = NULL;
 
+  //subcommands
+  if (argc > 1 && strcmp(argv[1], "combine") == 0) {
+    return combine_main(argc - 1, argv + 1);
+  }
+
   static struct option long_options[] = {
       {"verbose", no_argument, 0, 'v'},
       {"utf8", no_argument, 0, '8'},
       {"username", required_argument, 0, 'u'},
       {"password", required_argument, 0, 'p'},
       {"embed-auth", no_argument, 0, 'e'},
+      {"dedup", optional_argument, 0, 'd'},
+      {"journal", required_argument, 0, 'j'},
+      {"resume", no_argument, 0, 'r'},
+      {"deadline", required_argument, 0, 't'},
+      {"backfill", no_argument, 0, 'b'},
+      {"cache", optional_argument, 0, 'c'},
+      {"webdav", no_argument, 0, 'w'},
+      {"shard", required_argument, 0, 's'},
+      {"merge", required_argument, 0, 'm'},
       {"help", no_argument, 0, 'h'},
       {0, 0, 0, 0}};
 
   int opt;
   int option_index = 0;
 
-  while ((opt = getopt_long(argc, argv, "v8u:p:eh", long_options,
+  while ((opt = getopt_long(argc, argv, "v8u:p:ed::j:rt:bc::ws:m:h", long_options,
                             &option_index)) != -1) {
     switch (opt) {
     case 'v':
@@ -48,6 +113,54 @@ int main(int argc, char *argv[]) {
     case 'e':
       flag_embed_auth = 1;
       break;
+    case 'd':
+      dedup_mode = parse_dedup_mode(optarg);
+      if (dedup_mode < 0) {
+        fprintf(stderr, "ERROR: Unknown dedup mode %s. Use -h for help.\n",
+                optarg);
+        return -1;
+      }
+      break;
+    case 'j':
+      journal_path = optarg;
+      break;
+    case 'r':
+      flag_resume = 1;
+      break;
+    case 't': {
+      char *end;
+      deadline = strtod(optarg, &end);
+      if (end == optarg || *end || deadline <= 0) {
+        fprintf(stderr, "ERROR: Invalid deadline %s. Use -h for help.\n",
+                optarg);
+        return -1;
+      }
+      break;
+    }
+    case 'b':
+      flag_backfill = 1;
+      break;
+    case 'c':
+      free(cache_dir);
+      cache_dir = optarg ? expand_path(optarg) : default_cache_dir();
+      if (!cache_dir) {
+        fprintf(stderr, "ERROR: No cache directory, use --cache=DIR\n");
+        return -1;
+      }
+      break;
+    case 'w':
+      flag_webdav = 1;
+      break;
+    case 's':
+      if (parse_shard(optarg, &shard_index, &shard_count) != 0) {
+        fprintf(stderr, "ERROR: Invalid shard %s, expected I/N with I < N.\n",
+                optarg);
+        return -1;
+      }
+      break;
+    case 'm':
+      merge_output = optarg;
+      break;
     case 'h':
       print_usage(argv[0]);
       return 0;
@@ -57,6 +170,38 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  //merge mode: every argument is a shard result, nothing is probed
+  if (merge_output) {
+    if (optind >= argc) {
+      fprintf(stderr, "ERROR: --merge needs shard result files.\n");
+      return -1;
+    }
+
+    int merged_count;
+    media_file *merged =
+        merge_shards(&argv[optind], argc - optind, &merged_count);
+    if (!merged) {
+      fprintf(stderr, "Failed to merge shard results.\n");
+      return -1;
+    }
+
+    char *merged_filename = expand_path(merge_output);
+    int result = write_m3u(merged, merged_count, merged_filename,
+                           flag_embed_auth, username, password);
+    if (result == 0 && flag_verbose) {
+      printf("Merged %d shards into %d entries.\n", argc - optind,
+             merged_count);
+    }
+
+    free_media_files(merged, merged_count);
+    free(merged_filename);
+    if (username)
+      free(username);
+    if (password)
+      free(password);
+    return result;
+  }
+
   // Check for required arguments
   if (optind >= argc) {
     fprintf(
@@ -65,6 +210,21 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
+  if (flag_resume && !journal_path) {
+    fprintf(stderr, "ERROR: --resume needs a --journal file.\n");
+    return -1;
+  }
+
+  //PROPFIND responses are not cached, don't let -c look like it works
+  if (flag_webdav && cache_dir) {
+    fprintf(stderr, "ERROR: --cache does not apply to --webdav listings.\n");
+    free(cache_dir);
+    return -1;
+  }
+
+  //the budget covers scanning too
+  set_probe_deadline(deadline);
+
   input = argv[optind++];
 
   if (optind < argc) {
@@ -76,6 +236,13 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
+  if (shard_count > 0 && !output_filename) {
+    char name[64];
+    snprintf(name, sizeof(name), "shard-%d-of-%d.d2m3u", shard_index,
+             shard_count);
+    output_filename = strdup(name);
+  }
+
   if (flag_verbose) {
     av_log_set_level(AV_LOG_VERBOSE);
   }
@@ -109,11 +276,19 @@ int main(int argc, char *argv[]) {
     }
     else { //web directory
       if (flag_verbose) {
-        printf("Scanning web directory: %s\n", input);
+        printf("Scanning %s directory: %s\n", flag_webdav ? "WebDAV" : "web",
+               input);
+      }
+      if (flag_webdav) {
+        file_count = scan_webdav_directory(input, files, username, password);
+      }
+      else {
+        file_count =
+            scan_web_directory(input, files, username, password, cache_dir);
       }
-      file_count = scan_web_directory(input, files, username, password);
       if (file_count < 0) {
         fprintf(stderr, "Failed to scan web directory.\n");
+        free(cache_dir);
         if (username)
           free(username);
         if (password)
@@ -154,6 +329,8 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  free(cache_dir);
+
   if (file_count == 0) {
     fprintf(stderr, "No media files found.\n");
     if (username)
@@ -167,11 +344,54 @@ int main(int argc, char *argv[]) {
     printf("Found %d media files.\n", file_count);
   }
 
+  if (shard_count > 0) {
+    file_count = shard_files(files, file_count, shard_index, shard_count);
+    if (flag_verbose) {
+      printf("Shard %d/%d has %d media files.\n", shard_index, shard_count,
+             file_count);
+    }
+
+    //an empty shard still leaves a result for --merge
+    if (file_count == 0) {
+      int result = write_shard(NULL, 0, output_filename);
+      free((void *)output_filename);
+      if (username)
+        free(username);
+      if (password)
+        free(password);
+      return result;
+    }
+  }
+
+  journal jr;
+  if (journal_path && journal_open(&jr, journal_path, flag_resume) != 0) {
+    fprintf(stderr, "Failed to open journal %s\n", journal_path);
+    if (username)
+      free(username);
+    if (password)
+      free(password);
+    return -1;
+  }
+
+  if (flag_verbose && journal_path && jr.count > 0) {
+    printf("Resuming with %d results from %s\n", jr.count, journal_path);
+  }
+
+  //first ^C stops probing and writes what we have, a second one kills
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_sigint;
+  sa.sa_flags = SA_RESETHAND;
+  sigaction(SIGINT, &sa, NULL);
+
   int media_count;
   media_file *mfs = collect_media_info(files, file_count, &media_count,
-                                       final_username, final_password);
+                                       final_username, final_password,
+                                       dedup_mode, journal_path ? &jr : NULL);
   if (!mfs || media_count == 0) {
     fprintf(stderr, "Failed to collect media info.\n");
+    if (journal_path)
+      journal_close(&jr, 0);
     if (username)
       free(username);
     if (password)
@@ -183,8 +403,48 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
-  int result = write_m3u(mfs, media_count, output_filename, flag_embed_auth,
-                         final_username, final_password);
+  int result = write_output(mfs, media_count, output_filename, shard_count,
+                            flag_embed_auth, final_username, final_password);
+
+  //files the deadline skipped are still pending, keep probing them and
+  //rewrite the playlist as results arrive
+  int incomplete = 0;
+  for (int i = 0; i < media_count; i++) {
+    if (mfs[i].duration == DURATION_PENDING)
+      incomplete = 1;
+  }
+
+  if (result == 0 && incomplete && flag_backfill) {
+    if (flag_verbose) {
+      printf("Deadline reached, backfilling durations.\n");
+    }
+
+    set_probe_deadline(0);
+    int next = 0;
+    while (result == 0 &&
+           backfill_media_info(mfs, media_count, &next, BACKFILL_BATCH,
+                               final_username, final_password,
+                               journal_path ? &jr : NULL) > 0) {
+      result = write_output(mfs, media_count, output_filename, shard_count,
+                            flag_embed_auth, final_username, final_password);
+    }
+    incomplete = probe_interrupted;
+  }
+  else if (result == 0 && incomplete) {
+    fprintf(stderr, "Deadline reached, some durations are unknown.\n");
+  }
+
+  if (result == 0 && probe_interrupted) {
+    fprintf(stderr, "Interrupted, wrote a partial playlist of %d files.\n",
+            media_count);
+    if (journal_path)
+      fprintf(stderr, "Continue with --resume --journal %s\n", journal_path);
+    result = -1;
+  }
+
+  //a complete scan leaves nothing to resume
+  if (journal_path)
+    journal_close(&jr, result == 0 && !incomplete);
 
   if (result == 0 && flag_verbose) {
     printf("Playlist created successfully.\n");
@@ -212,11 +472,32 @@ int main(int argc, char *argv[]) {
 
 void print_usage(const char *name) {
   printf("Usage: %s [OPTIONS] <dir|file|url> [output]\n", name);
+  printf("       %s [OPTIONS] --merge OUTPUT <shard>...\n", name);
+  printf("       %s combine [OPTIONS] <output> <playlist>...\n", name);
   printf("Opts:\n");
   printf("  -v, --verbose          Enable verbose output\n");
   //printf("  -8, --utf8             Use UTF-8 encoding (m3u8)\n"); //not implemented
   printf("  -u, --username USER    Username for HTTP authentication\n");
   printf("  -p, --password PASS    Password for HTTP authentication\n");
   printf("  -e, --embed-auth       Embed username/password in playlist URLs\n");
+  printf("  -d, --dedup[=MODE]     Probe identical local files once. MODE is\n");
+  printf("                         collapse (default, drop copies) or copy\n");
+  printf("                         (keep copies with the same info). Files\n");
+  printf("                         over 4mb are compared on sampled blocks\n");
+  printf("  -j, --journal FILE     Append each probe result to FILE as it\n");
+  printf("                         completes\n");
+  printf("  -r, --resume           Reuse results from the --journal FILE of an\n");
+  printf("                         interrupted run and probe only the rest\n");
+  printf("  -t, --deadline SECS    Write the playlist after SECS seconds, files\n");
+  printf("                         not probed by then get an unknown duration\n");
+  printf("  -b, --backfill         After the deadline, keep probing and rewrite\n");
+  printf("                         the playlist as durations arrive\n");
+  printf("  -c, --cache[=DIR]      Cache web listings in DIR (default\n");
+  printf("                         ~/.cache/d2m3u) and revalidate them\n");
+  printf("  -w, --webdav           List web directories recursively with WebDAV\n");
+  printf("                         PROPFIND instead of parsing index pages\n");
+  printf("  -s, --shard I/N        Probe only shard I (from 0) of N and write a\n");
+  printf("                         shard result to [output] for --merge\n");
+  printf("  -m, --merge OUTPUT     Merge shard results into the playlist OUTPUT\n");
   printf("  -h, --help             Show this help message\n");
 }
\ No newline at end of file
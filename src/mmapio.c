@@ -0,0 +1,172 @@
+//mmapio.c
+#include "mmapio.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//avio buffer handed back by the last closed file, reused by the next one
+static unsigned char *pooled_buffer = NULL;
+
+//a file truncated after it was mapped (e.g. still being synced into the
+//library) raises SIGBUS on the pages past its new end. the copy in
+//mmap_read jumps back out instead, so it ends like a short read would.
+//probes run on one thread, so a single jump buffer is enough
+static sigjmp_buf copy_env;
+static volatile sig_atomic_t copying = 0;
+static struct sigaction previous_bus;
+static int bus_guard_installed = 0;
+
+static void bus_handler(int sig) {
+  if (copying)
+    siglongjmp(copy_env, 1);
+
+  //not ours, let it crash as it would have
+  sigaction(SIGBUS, &previous_bus, NULL);
+  raise(sig);
+}
+
+static void install_bus_guard(void) {
+  if (bus_guard_installed)
+    return;
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = bus_handler;
+  sa.sa_flags = SA_NODEFER;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGBUS, &sa, &previous_bus) == 0)
+    bus_guard_installed = 1;
+}
+
+static int mmap_read(void *opaque, uint8_t *buf, int buf_size) {
+  mmap_io *io = opaque;
+  if (io->pos >= io->size)
+    return AVERROR_EOF;
+
+  size_t len = io->size - io->pos;
+  if (len > (size_t)buf_size)
+    len = buf_size;
+
+  //no mask save, that would cost a syscall per read. SA_NODEFER keeps
+  //SIGBUS unblocked after the jump instead
+  if (sigsetjmp(copy_env, 0)) {
+    copying = 0;
+    fprintf(stderr, "File shrank while probing\n");
+    io->size = io->pos;
+    return AVERROR_EOF;
+  }
+
+  copying = 1;
+  memcpy(buf, io->data + io->pos, len);
+  copying = 0;
+
+  io->pos += len;
+  return (int)len;
+}
+
+static int64_t mmap_seek(void *opaque, int64_t offset, int whence) {
+  mmap_io *io = opaque;
+  int64_t base;
+
+  switch (whence & ~AVSEEK_FORCE) {
+  case AVSEEK_SIZE:
+    return io->size;
+  case SEEK_SET:
+    base = 0;
+    break;
+  case SEEK_CUR:
+    base = io->pos;
+    break;
+  case SEEK_END:
+    base = io->size;
+    break;
+  default:
+    return AVERROR(EINVAL);
+  }
+
+  if (base + offset < 0)
+    return AVERROR(EINVAL);
+
+  //past the end is allowed, reads there just hit eof
+  io->pos = base + offset;
+  return io->pos;
+}
+
+//maps path and builds an AVIOContext reading straight from the mapping.
+//only the first probe_size bytes are prefetched, the rest faults in with
+//normal readahead when the demuxer goes there (e.g. a trailing moov atom)
+int mmap_io_open(mmap_io *io, const char *path, size_t probe_size) {
+  memset(io, 0, sizeof(*io));
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return -1;
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return -1;
+
+  io->data = data;
+  io->size = st.st_size;
+
+  madvise(io->data, probe_size < io->size ? probe_size : io->size,
+          MADV_WILLNEED);
+  install_bus_guard();
+
+  unsigned char *buffer = pooled_buffer;
+  pooled_buffer = NULL;
+  if (!buffer)
+    buffer = av_malloc(MMAP_IO_BUFFER);
+  if (!buffer) {
+    munmap(io->data, io->size);
+    io->data = NULL;
+    return -1;
+  }
+
+  io->pb = avio_alloc_context(buffer, MMAP_IO_BUFFER, 0, io, mmap_read, NULL,
+                              mmap_seek);
+  if (!io->pb) {
+    av_free(buffer);
+    munmap(io->data, io->size);
+    io->data = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+//call after avformat_close_input, custom io is not freed by ffmpeg
+void mmap_io_close(mmap_io *io) {
+  if (io->pb) {
+    //ffmpeg may have swapped the buffer for a bigger one, only pool ours
+    if (!pooled_buffer && io->pb->buffer_size == MMAP_IO_BUFFER)
+      pooled_buffer = io->pb->buffer;
+    else
+      av_free(io->pb->buffer);
+    io->pb->buffer = NULL;
+    avio_context_free(&io->pb);
+  }
+
+  if (io->data)
+    munmap(io->data, io->size);
+
+  memset(io, 0, sizeof(*io));
+}
+
+void mmap_io_release_pool(void) {
+  av_free(pooled_buffer);
+  pooled_buffer = NULL;
+}
@@ -0,0 +1,21 @@
+//mmapio.h
+#ifndef MMAPIO_H
+#define MMAPIO_H
+
+#include <libavformat/avio.h>
+#include <stddef.h>
+
+#define MMAP_IO_BUFFER 32768 //same as ffmpeg's file: protocol
+
+typedef struct {
+  unsigned char *data;
+  size_t size;
+  size_t pos;
+  AVIOContext *pb;
+} mmap_io;
+
+int mmap_io_open(mmap_io *io, const char *path, size_t probe_size);
+void mmap_io_close(mmap_io *io);
+void mmap_io_release_pool(void);
+
+#endif //MMAPIO_H
@@ -0,0 +1,162 @@
+//shard.c
+#include "shard.h"
+#include "fileutils.h"
+#include "journal.h"
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+//"i/N" with 0 <= i < N
+int parse_shard(const char *arg, int *index, int *count) {
+  char *end;
+  long i = strtol(arg, &end, 10);
+  if (end == arg || *end != '/')
+    return -1;
+
+  const char *rest = end + 1;
+  long n = strtol(rest, &end, 10);
+  if (end == rest || *end || n < 1 || i < 0 || i >= n)
+    return -1;
+
+  *index = (int)i;
+  *count = (int)n;
+  return 0;
+}
+
+//keeps only the files of shard index out of count, in their sorted
+//order. the split is by fnv-1a of the path, so every node agrees on it
+//without talking to the others. returns the new number of files
+int shard_files(char *files[], int n, int index, int count) {
+  int kept = 0;
+  for (int i = 0; i < n; i++) {
+    if (fnv1a_hash(files[i]) % count == (uint64_t)index)
+      files[kept++] = files[i];
+    else
+      free(files[i]);
+  }
+  return kept;
+}
+
+//a shard result is a journal holding the results in playlist order. it
+//is rewritten on every backfill batch, so it goes through a temp file
+//and a merge running meanwhile sees the old result or the new one
+int write_shard(media_file mfs[], int count, const char *path) {
+  char target[PATH_MAX];
+  char tmppath[REPLACE_TMP_MAX];
+  FILE *fp = replace_file_open(path, target, tmppath);
+  if (!fp)
+    return -1;
+
+  journal part;
+  journal_attach(&part, fp);
+
+  int result = 0;
+  for (int i = 0; i < count && result == 0; i++)
+    result = journal_append(&part, &mfs[i]);
+
+  if (result != 0) {
+    fclose(fp);
+    if (tmppath[0])
+      unlink(tmppath);
+    return -1;
+  }
+
+  //on disk before the rename publishes it
+  if (tmppath[0])
+    fsync(fileno(fp));
+  return replace_file_commit(fp, tmppath, target);
+}
+
+typedef struct {
+  journal_reader rd;
+  media_file head;
+  int live;
+} shard_cursor;
+
+static void free_head(shard_cursor *c) {
+  free(c->head.path);
+  free(c->head.filename);
+  if (c->head.title)
+    free(c->head.title);
+}
+
+static void advance(shard_cursor *c) {
+  c->live = journal_read(&c->rd, &c->head);
+}
+
+//k-way merge of shard results that are each sorted by path, so the
+//result matches a single node run. k is small, a linear pick is enough
+media_file *merge_shards(char *parts[], int nparts, int *out_count) {
+  *out_count = 0;
+
+  shard_cursor *cursors = calloc(nparts, sizeof(shard_cursor));
+  if (!cursors) {
+    perror("calloc");
+    return NULL;
+  }
+
+  int ok = 1;
+  for (int i = 0; i < nparts && ok; i++) {
+    ok = journal_reader_open(&cursors[i].rd, parts[i]) == 0;
+    if (ok)
+      advance(&cursors[i]);
+  }
+
+  int capacity = 256;
+  int count = 0;
+  media_file *mfs = ok ? malloc(capacity * sizeof(media_file)) : NULL;
+
+  while (mfs) {
+    int best = -1;
+    for (int i = 0; i < nparts; i++) {
+      if (cursors[i].live &&
+          (best < 0 ||
+           strcmp(cursors[i].head.path, cursors[best].head.path) < 0))
+        best = i;
+    }
+    if (best < 0)
+      break;
+
+    //a path in two shards means the same shard was given twice
+    if (count > 0 &&
+        strcmp(mfs[count - 1].path, cursors[best].head.path) == 0) {
+      free_head(&cursors[best]);
+      advance(&cursors[best]);
+      continue;
+    }
+
+    if (count == capacity) {
+      capacity *= 2;
+      media_file *grown = realloc(mfs, capacity * sizeof(media_file));
+      if (!grown) {
+        //a short merge would be written as if complete
+        perror("realloc");
+        ok = 0;
+        break;
+      }
+      mfs = grown;
+    }
+
+    mfs[count++] = cursors[best].head;
+    advance(&cursors[best]);
+  }
+
+  for (int i = 0; i < nparts; i++) {
+    if (cursors[i].live)
+      free_head(&cursors[i]);
+    journal_reader_close(&cursors[i].rd);
+  }
+  free(cursors);
+
+  if (!ok) {
+    if (mfs)
+      free_media_files(mfs, count);
+    return NULL;
+  }
+
+  *out_count = count;
+  return mfs;
+}
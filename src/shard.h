@@ -0,0 +1,12 @@
+//shard.h
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "writem3u.h"
+
+int parse_shard(const char *arg, int *index, int *count);
+int shard_files(char *files[], int n, int index, int count);
+int write_shard(media_file mfs[], int count, const char *path);
+media_file *merge_shards(char *parts[], int nparts, int *out_count);
+
+#endif //SHARD_H
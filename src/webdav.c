@@ -0,0 +1,666 @@
+//webdav.c
+#include "webdav.h"
+#include "fileutils.h"
+#include <ctype.h>
+#include <curl/curl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *propfind_body =
+    "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+    "<D:propfind xmlns:D=\"DAV:\"><D:prop>"
+    "<D:resourcetype/><D:getcontentlength/><D:getetag/>"
+    "</D:prop></D:propfind>\n";
+
+typedef struct {
+  struct MemoryStruct pending; //unparsed tail of the multistatus body
+  const char *request_url;
+  webdav_entry *entries;
+  int count;
+  int capacity;
+  int walk;            //collect subcollections for the depth 1 fallback
+  char **collections;  //every collection queued so far, listed or not
+  char **visited;      //their keys, see href_key
+  int ncollections;
+  int dropped;         //subcollections over WEBDAV_MAX_COLLECTIONS
+  int in_response;     //pending starts inside an open <response>
+  size_t close_from;   //where the search for its close tag resumes
+} propfind_state;
+
+//name matches the local part of a possibly prefixed tag name (D:href)
+static int local_name_is(const char *tag, size_t len, const char *name) {
+  const char *colon = memchr(tag, ':', len);
+  if (colon) {
+    len -= colon + 1 - tag;
+    tag = colon + 1;
+  }
+  return strlen(name) == len && strncmp(tag, name, len) == 0;
+}
+
+static size_t tag_name_len(const char *p, const char *end) {
+  size_t len = 0;
+  while (p + len < end && p[len] != ' ' && p[len] != '\t' && p[len] != '\n' &&
+         p[len] != '\r' && p[len] != '/' && p[len] != '>')
+    len++;
+  return len;
+}
+
+//finds the next opening tag called name in [p, end). sets *empty for <x/>
+static const char *find_open_tag(const char *p, const char *end,
+                                 const char *name, int *empty) {
+  while (p < end && (p = memchr(p, '<', end - p)) != NULL) {
+    p++;
+    if (p >= end || *p == '/' || *p == '?' || *p == '!')
+      continue;
+
+    size_t len = tag_name_len(p, end);
+    if (!local_name_is(p, len, name))
+      continue;
+
+    const char *close = memchr(p, '>', end - p);
+    if (!close)
+      return NULL;
+    *empty = close[-1] == '/';
+    return close + 1;
+  }
+  return NULL;
+}
+
+//returns the position after the next closing tag called name, or NULL
+static const char *find_close_tag(const char *p, const char *end,
+                                  const char *name) {
+  while (p < end && (p = memchr(p, '<', end - p)) != NULL) {
+    p++;
+    if (p >= end || *p != '/')
+      continue;
+    p++;
+
+    size_t len = tag_name_len(p, end);
+    if (!local_name_is(p, len, name))
+      continue;
+
+    const char *close = memchr(p, '>', end - p);
+    return close ? close + 1 : NULL;
+  }
+  return NULL;
+}
+
+//copies the text of the first element called name, decoding entities
+static char *element_text(const char *p, const char *end, const char *name) {
+  int empty;
+  const char *start = find_open_tag(p, end, name, &empty);
+  if (!start)
+    return NULL;
+  if (empty)
+    return strdup("");
+
+  const char *stop = memchr(start, '<', end - start);
+  if (!stop)
+    return NULL;
+
+  char *text = malloc(stop - start + 1);
+  char *out = text;
+  for (const char *s = start; s < stop; s++) {
+    if (*s != '&') {
+      *out++ = *s;
+    }
+    else if (strncmp(s, "&amp;", 5) == 0) {
+      *out++ = '&';
+      s += 4;
+    }
+    else if (strncmp(s, "&lt;", 4) == 0) {
+      *out++ = '<';
+      s += 3;
+    }
+    else if (strncmp(s, "&gt;", 4) == 0) {
+      *out++ = '>';
+      s += 3;
+    }
+    else if (strncmp(s, "&quot;", 6) == 0) {
+      *out++ = '"';
+      s += 5;
+    }
+    else if (strncmp(s, "&apos;", 6) == 0) {
+      *out++ = '\'';
+      s += 5;
+    }
+    else {
+      *out++ = *s;
+    }
+  }
+  *out = '\0';
+  return text;
+}
+
+//hrefs are usually absolute paths, resolve them against the request origin.
+//absolute urls are rebased on it too, a server reached under another host
+//name or behind a proxy reports its own idea of scheme and host
+static char *resolve_href(const char *request_url, const char *href) {
+  if (is_web_url(href)) {
+    href = strchr(strstr(href, "://") + 3, '/');
+    if (!href)
+      href = "/";
+  }
+
+  const char *host = strstr(request_url, "://");
+  host = host ? host + 3 : request_url;
+  const char *path = strchr(host, '/');
+  size_t origin_len = path ? (size_t)(path - request_url) : strlen(request_url);
+
+  size_t base_len = strlen(request_url);
+  size_t len = base_len + strlen(href) + 2;
+  char *url = malloc(len);
+
+  if (href[0] == '/') {
+    snprintf(url, len, "%.*s%s", (int)origin_len, request_url, href);
+  }
+  else {
+    //relative to the collection being listed
+    snprintf(url, len, "%s%s%s", request_url,
+             request_url[base_len - 1] == '/' ? "" : "/", href);
+  }
+  return url;
+}
+
+//percent-decoded path of an url without trailing slashes. collections and
+//entries are compared by it, since servers differ in how they encode hrefs
+static char *href_key(const char *url) {
+  const char *p = url;
+  const char *scheme = strstr(url, "://");
+  if (scheme) {
+    p = strchr(scheme + 3, '/');
+    if (!p)
+      p = "";
+  }
+
+  size_t len = strcspn(p, "?#");
+  char *key = malloc(len + 1);
+  if (!key)
+    return NULL;
+
+  size_t k = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (p[i] == '%' && i + 2 < len && isxdigit((unsigned char)p[i + 1]) &&
+        isxdigit((unsigned char)p[i + 2])) {
+      char hex[3] = {p[i + 1], p[i + 2], '\0'};
+      key[k++] = (char)strtol(hex, NULL, 16);
+      i += 2;
+    }
+    else {
+      key[k++] = p[i];
+    }
+  }
+  while (k > 0 && key[k - 1] == '/')
+    k--;
+  key[k] = '\0';
+  return key;
+}
+
+//queues url for listing unless it was queued before. the walk is capped
+//at WEBDAV_MAX_COLLECTIONS, so the linear lookup stays cheap. takes url
+static void add_collection(propfind_state *st, char *url) {
+  char *key = href_key(url);
+  if (!key) {
+    free(url);
+    return;
+  }
+
+  for (int i = 0; i < st->ncollections; i++) {
+    if (strcmp(st->visited[i], key) == 0) {
+      free(key);
+      free(url);
+      return;
+    }
+  }
+
+  if (st->ncollections >= WEBDAV_MAX_COLLECTIONS) {
+    st->dropped++;
+    free(key);
+    free(url);
+    return;
+  }
+
+  char **grown_urls =
+      realloc(st->collections, (st->ncollections + 1) * sizeof(char *));
+  if (grown_urls)
+    st->collections = grown_urls;
+  char **grown_keys =
+      realloc(st->visited, (st->ncollections + 1) * sizeof(char *));
+  if (grown_keys)
+    st->visited = grown_keys;
+
+  if (!grown_urls || !grown_keys) {
+    st->dropped++;
+    free(key);
+    free(url);
+    return;
+  }
+
+  st->collections[st->ncollections] = url;
+  st->visited[st->ncollections] = key;
+  st->ncollections++;
+}
+
+//handles one complete <response> element
+static void parse_response(propfind_state *st, const char *p,
+                           const char *end) {
+  char *href = element_text(p, end, "href");
+  if (!href || !*href) {
+    free(href);
+    return;
+  }
+
+  char *url = resolve_href(st->request_url, href);
+  free(href);
+
+  int empty;
+  const char *rtype = find_open_tag(p, end, "resourcetype", &empty);
+  const char *rtype_end = rtype && !empty
+                              ? find_close_tag(rtype, end, "resourcetype")
+                              : NULL;
+  int is_collection =
+      rtype_end && find_open_tag(rtype, rtype_end, "collection", &empty);
+
+  //the collection itself comes back as well, already queued by then
+  if (is_collection) {
+    if (st->walk)
+      add_collection(st, url);
+    else
+      free(url);
+    return;
+  }
+
+  if (st->count == st->capacity) {
+    int capacity = st->capacity ? st->capacity * 2 : 256;
+    webdav_entry *grown =
+        realloc(st->entries, capacity * sizeof(webdav_entry));
+    if (!grown) {
+      free(url);
+      return;
+    }
+    st->entries = grown;
+    st->capacity = capacity;
+  }
+
+  webdav_entry *entry = &st->entries[st->count++];
+  entry->url = url;
+
+  char *length = element_text(p, end, "getcontentlength");
+  entry->size = length && *length ? strtoll(length, NULL, 10) : -1;
+  free(length);
+
+  entry->etag = element_text(p, end, "getetag");
+  if (entry->etag && !*entry->etag) {
+    free(entry->etag);
+    entry->etag = NULL;
+  }
+}
+
+//position of the last '<' in [p, end), or end. a tag that starts there
+//may still be cut off by the chunk boundary
+static const char *last_tag_start(const char *p, const char *end) {
+  for (const char *q = end; q > p; q--) {
+    if (q[-1] == '<')
+      return q - 1;
+  }
+  return end;
+}
+
+//parses each <response> as soon as it is complete, so a depth infinity
+//listing of a huge tree never has to sit in memory as a whole. scanning
+//resumes where the last chunk left off, text outside any <response> (an
+//html error page, say) is dropped right away, and one unfinished element
+//may not grow past WEBDAV_MAX_PENDING
+static size_t propfind_write_callback(void *contents, size_t size,
+                                      size_t nmemb, void *userp) {
+  size_t realsize = size * nmemb;
+  propfind_state *st = (propfind_state *)userp;
+  struct MemoryStruct *mem = &st->pending;
+
+  char *ptr = realloc(mem->memory, mem->size + realsize + 1);
+  if (!ptr) {
+    fprintf(stderr, "Not enough memory for realloc\n");
+    return 0;
+  }
+  mem->memory = ptr;
+  memcpy(&(mem->memory[mem->size]), contents, realsize);
+  mem->size += realsize;
+  mem->memory[mem->size] = 0;
+
+  const char *p = mem->memory;
+  const char *end = mem->memory + mem->size;
+  const char *keep;
+  int empty;
+
+  for (;;) {
+    if (!st->in_response) {
+      const char *start = find_open_tag(p, end, "response", &empty);
+      if (!start) {
+        keep = last_tag_start(p, end);
+        break;
+      }
+      if (empty) {
+        p = start;
+        continue;
+      }
+      st->in_response = 1;
+      st->close_from = start - mem->memory;
+      p = start;
+    }
+
+    const char *close =
+        find_close_tag(mem->memory + st->close_from, end, "response");
+    if (!close) {
+      //only a cut off tag at the very end can still become the close tag
+      st->close_from =
+          last_tag_start(mem->memory + st->close_from, end) - mem->memory;
+      keep = p;
+      break;
+    }
+
+    parse_response(st, p, close);
+    st->in_response = 0;
+    p = close;
+  }
+
+  //keep only the incomplete tail
+  size_t consumed = keep - mem->memory;
+  memmove(mem->memory, keep, mem->size - consumed + 1);
+  mem->size -= consumed;
+  if (st->in_response)
+    st->close_from -= consumed;
+
+  if (mem->size > WEBDAV_MAX_PENDING) {
+    fprintf(stderr, "WebDAV response element over %d bytes\n",
+            WEBDAV_MAX_PENDING);
+    return 0;
+  }
+
+  return realsize;
+}
+
+static void begin_body(propfind_state *st, const char *url) {
+  st->request_url = url;
+  st->pending.memory = malloc(1);
+  st->pending.memory[0] = 0;
+  st->pending.size = 0;
+  st->in_response = 0;
+  st->close_from = 0;
+}
+
+static void end_body(propfind_state *st) {
+  free(st->pending.memory);
+  st->pending.memory = NULL;
+  st->request_url = NULL;
+}
+
+//one PROPFIND request, returns the http status or -1
+static long propfind(const char *url, const char *depth, const char *username,
+                     const char *password, propfind_state *st) {
+  CURL *curl = curl_easy_init();
+  if (!curl) {
+    fprintf(stderr, "Failed to initialize CURL\n");
+    return -1;
+  }
+
+  char depth_header[32];
+  snprintf(depth_header, sizeof(depth_header), "Depth: %s", depth);
+  struct curl_slist *headers = NULL;
+  headers = curl_slist_append(headers, depth_header);
+  headers = curl_slist_append(headers, "Content-Type: application/xml");
+
+  begin_body(st, url);
+
+  curl_easy_setopt(curl, CURLOPT_URL, url);
+  curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PROPFIND");
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, propfind_body);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, propfind_write_callback);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)st);
+  curl_easy_setopt(curl, CURLOPT_USERAGENT, "libcurl-agent/1.0");
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  //a whole tree takes longer than one listing page
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT, 300L);
+
+  if (username) {
+    curl_easy_setopt(curl, CURLOPT_USERNAME, username);
+    if (password) {
+      curl_easy_setopt(curl, CURLOPT_PASSWORD, password);
+    }
+    curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
+  }
+
+  long response_code = -1;
+  CURLcode res = curl_easy_perform(curl);
+  if (res != CURLE_OK) {
+    fprintf(stderr, "curl_easy_perform() failed: %s\n",
+            curl_easy_strerror(res));
+  }
+  else {
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+  }
+
+  curl_slist_free_all(headers);
+  curl_easy_cleanup(curl);
+  end_body(st);
+  return response_code;
+}
+
+static void free_collections(propfind_state *st) {
+  for (int i = 0; i < st->ncollections; i++) {
+    free(st->collections[i]);
+    free(st->visited[i]);
+  }
+  free(st->collections);
+  free(st->visited);
+  st->collections = NULL;
+  st->visited = NULL;
+  st->ncollections = 0;
+}
+
+typedef struct {
+  char *key;
+  int idx;
+} entry_key;
+
+static int compare_entry_keys(const void *a, const void *b) {
+  const entry_key *x = a, *y = b;
+  int c = strcmp(x->key, y->key);
+  return c ? c : x->idx - y->idx;
+}
+
+//drops entries whose path was already listed, keeping the first one and
+//the original order. returns the new count
+static int dedupe_entries(webdav_entry *entries, int count) {
+  entry_key *keys = malloc(count * sizeof(entry_key));
+  char *dup = calloc(count, 1);
+  if (!keys || !dup) {
+    free(keys);
+    free(dup);
+    return count;
+  }
+
+  int nkeys = 0;
+  for (int i = 0; i < count; i++) {
+    keys[nkeys].key = href_key(entries[i].url);
+    keys[nkeys].idx = i;
+    if (keys[nkeys].key)
+      nkeys++;
+  }
+
+  qsort(keys, nkeys, sizeof(entry_key), compare_entry_keys);
+  for (int i = 1; i < nkeys; i++) {
+    if (strcmp(keys[i].key, keys[i - 1].key) == 0)
+      dup[keys[i].idx] = 1;
+  }
+
+  int kept = 0;
+  for (int i = 0; i < count; i++) {
+    if (dup[i]) {
+      free(entries[i].url);
+      free(entries[i].etag);
+    }
+    else {
+      entries[kept++] = entries[i];
+    }
+  }
+
+  for (int i = 0; i < nkeys; i++)
+    free(keys[i].key);
+  free(keys);
+  free(dup);
+  return kept;
+}
+
+//lists every file below url. tries a single Depth: infinity request and
+//walks the tree one Depth: 1 request per collection if the server
+//refuses (most do by default, answering 403 propfind-finite-depth)
+int webdav_list(const char *url, const char *username, const char *password,
+                webdav_entry **out) {
+  propfind_state st;
+  memset(&st, 0, sizeof(st));
+  *out = NULL;
+
+  char *clean_url = NULL;
+  char *url_user = NULL;
+  char *url_pass = NULL;
+  extract_auth_from_url(url, &clean_url, &url_user, &url_pass);
+
+  const char *final_user = username ? username : url_user;
+  const char *final_pass = password ? password : url_pass;
+
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+
+  int result = 0;
+  long code = propfind(clean_url, "infinity", final_user, final_pass, &st);
+
+  if (code != 207 && code != 401 && code != -1) {
+    //refused, start over level by level. entries from a partial
+    //response are dropped so nothing is listed twice
+    webdav_free_entries(st.entries, st.count);
+    st.entries = NULL;
+    st.count = st.capacity = 0;
+
+    //the root is queued first so its own response is recognised as seen
+    st.walk = 1;
+    add_collection(&st, strdup(clean_url));
+
+    for (int next = 0; next < st.ncollections; next++) {
+      long sub =
+          propfind(st.collections[next], "1", final_user, final_pass, &st);
+      if (next == 0) {
+        code = sub;
+        if (code != 207)
+          break;
+      }
+      else if (sub != 207) {
+        fprintf(stderr, "PROPFIND %s failed: %ld\n", st.collections[next],
+                sub);
+      }
+    }
+
+    if (st.dropped > 0) {
+      fprintf(stderr,
+              "WARNING: Stopped after %d collections, %d subtrees were not "
+              "listed\n",
+              WEBDAV_MAX_COLLECTIONS, st.dropped);
+    }
+  }
+
+  if (code == 401) {
+    fprintf(stderr, "Authentication failed (401 Unauthorized)\n");
+    result = -1;
+  }
+  else if (code != 207) {
+    if (code != -1)
+      fprintf(stderr, "WebDAV error: %ld\n", code);
+    result = -1;
+  }
+
+  curl_global_cleanup();
+  free_collections(&st);
+  free(clean_url);
+  if (url_user)
+    free(url_user);
+  if (url_pass)
+    free(url_pass);
+
+  if (result < 0) {
+    webdav_free_entries(st.entries, st.count);
+    return -1;
+  }
+
+  *out = st.entries;
+  return dedupe_entries(st.entries, st.count);
+}
+
+//feeds body through the streaming parser in chunk byte pieces the way
+//curl hands it over, queueing subcollections like the depth 1 walk. for
+//the fuzz harness, returns the entry count or -1 if the body was refused
+int webdav_parse(const char *body, size_t len, size_t chunk,
+                 const char *request_url, webdav_entry **out) {
+  propfind_state st;
+  memset(&st, 0, sizeof(st));
+  st.walk = 1;
+  add_collection(&st, strdup(request_url));
+  begin_body(&st, request_url);
+
+  if (chunk == 0)
+    chunk = len;
+
+  int ok = 1;
+  for (size_t off = 0; ok && off < len; off += chunk) {
+    size_t n = len - off < chunk ? len - off : chunk;
+    ok = propfind_write_callback((void *)(body + off), 1, n, &st) == n;
+  }
+
+  end_body(&st);
+  free_collections(&st);
+
+  if (!ok) {
+    webdav_free_entries(st.entries, st.count);
+    *out = NULL;
+    return -1;
+  }
+
+  *out = st.entries;
+  return dedupe_entries(st.entries, st.count);
+}
+
+void webdav_free_entries(webdav_entry *entries, int count) {
+  for (int i = 0; i < count; i++) {
+    free(entries[i].url);
+    free(entries[i].etag);
+  }
+  free(entries);
+}
+
+//same contract as scan_web_directory, but over the whole tree
+int scan_webdav_directory(const char *url, char *files[], const char *username,
+                          const char *password) {
+  webdav_entry *entries;
+  int count = webdav_list(url, username, password, &entries);
+  if (count < 0)
+    return -1;
+
+  int file_count = 0;
+  for (int i = 0; i < count && file_count < MAX_FILES; i++) {
+    const char *name = strrchr(entries[i].url, '/');
+    if (is_allowed_filetype(name ? name + 1 : entries[i].url)) {
+      files[file_count++] = entries[i].url;
+      entries[i].url = NULL;
+    }
+  }
+
+  webdav_free_entries(entries, count);
+
+  if (file_count > 0) {
+    qsort(files, file_count, sizeof(char *), compare_files);
+  }
+  else {
+    fprintf(stderr, "No media files found in WebDAV listing\n");
+  }
+
+  return file_count;
+}
@@ -0,0 +1,24 @@
+//webdav.h
+#ifndef WEBDAV_H
+#define WEBDAV_H
+
+#include <stddef.h>
+
+#define WEBDAV_MAX_COLLECTIONS 4096 //level by level fallback limit
+#define WEBDAV_MAX_PENDING 1048576  //1mb, largest single <response>
+
+typedef struct {
+  char *url;
+  long long size; //getcontentlength, -1 if not reported
+  char *etag;     //getetag, NULL if not reported
+} webdav_entry;
+
+int webdav_list(const char *url, const char *username, const char *password,
+                webdav_entry **out);
+int webdav_parse(const char *body, size_t len, size_t chunk,
+                 const char *request_url, webdav_entry **out);
+void webdav_free_entries(webdav_entry *entries, int count);
+int scan_webdav_directory(const char *url, char *files[], const char *username,
+                          const char *password);
+
+#endif //WEBDAV_H
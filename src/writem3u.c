@@ -1,5 +1,10 @@
 //writem3u.c
 #include "writem3u.h"
+#include "dedup.h"
+#include "fileutils.h"
+#include "iosched.h"
+#include "journal.h"
+#include "mmapio.h"
 #include <libavformat/avformat.h>
 #include <libavutil/avutil.h>
 #include <libavutil/opt.h>
@@ -9,128 +14,294 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
-static int is_web_url(const char *path) {
-  return strncmp(path, "http://", 7) == 0 || strncmp(path, "https://", 8) == 0;
+static char *media_filename(const char *path) {
+  if (is_web_url(path)) {
+    const char *last_slash = strrchr(path, '/');
+    if (last_slash && *(last_slash + 1)) {
+      char *filename = strdup(last_slash + 1);
+      //remove queries
+      char *query = strchr(filename, '?');
+      if (query)
+        *query = '\0';
+      return filename;
+    }
+    return strdup("webstream");
+  }
+
+  char *path_copy = strdup(path);
+  char *filename = strdup(basename(path_copy));
+  free(path_copy);
+  return filename;
+}
+
+#define PROBE_PENDING -2
+#define PROBE_FAILED -1
+
+volatile sig_atomic_t probe_interrupted = 0;
+static double probe_deadline = 0;
+
+static double monotonic_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//seconds from now, 0 clears it
+void set_probe_deadline(double seconds) {
+  probe_deadline = seconds > 0 ? monotonic_seconds() + seconds : 0;
+}
+
+int probe_deadline_expired(void) {
+  return probe_deadline > 0 && monotonic_seconds() >= probe_deadline;
+}
+
+static int probe_should_stop(void *opaque) {
+  (void)opaque;
+  return probe_interrupted || probe_deadline_expired();
+}
+
+//probes a single file into mf. returns 0 on success
+static int probe_media(const char *path, media_file *mf, const char *username,
+                       const char *password) {
+  AVDictionary *options = NULL;
+  AVFormatContext *context = avformat_alloc_context();
+  if (!context)
+    return -1;
+
+  //lets SIGINT or the deadline abort a probe stuck on the network
+  context->interrupt_callback.callback = probe_should_stop;
+
+  const char *url_to_open = path;
+  char *modified_url = NULL;
+  mmap_io io = {0};
+
+  if (is_web_url(path)) {
+    av_dict_set(&options, "timeout", "10000000",
+                0); // 10s
+    av_dict_set(&options, "user_agent", "libavformat", 0);
+
+    if (username && password) {
+      //ffmpeg requires embedded credentials
+      const char *auth_start = strstr(path, "://");
+      if (auth_start) {
+        auth_start += 3;
+        const char *at_sign = strchr(auth_start, '@');
+
+        if (at_sign) {
+          url_to_open = path;
+        }
+        else {
+          const char *proto_end = strstr(path, "://") + 3;
+          size_t proto_len = proto_end - path;
+          size_t new_url_len =
+              strlen(path) + strlen(username) + strlen(password) + 10;
+
+          modified_url = malloc(new_url_len);
+          snprintf(modified_url, new_url_len, "%.*s%s:%s@%s", (int)proto_len,
+                   path, username, password, proto_end);
+          url_to_open = modified_url;
+        }
+      }
+    }
+  }
+  else {
+    //serve local reads from a mapping instead of the file: protocol
+    if (mmap_io_open(&io, path, PROBE_SIZE) == 0)
+      context->pb = io.pb;
+  }
+
+  if (avformat_open_input(&context, url_to_open, NULL, &options) != 0) {
+    fprintf(stderr, "Could not open file %s\n", path);
+    av_dict_free(&options);
+    mmap_io_close(&io);
+    if (modified_url)
+      free(modified_url);
+    return -1;
+  }
+
+  //mapped files get the same budget, so the demuxer stays inside the
+  //prefetched window
+  if (is_web_url(path) || io.pb) {
+    context->max_analyze_duration = ANALYSIS_DURATION;
+    context->probesize = PROBE_SIZE;
+  }
+
+  if (avformat_find_stream_info(context, NULL) < 0) {
+    fprintf(stderr, "Could not find stream information for file %s\n", path);
+    avformat_close_input(&context);
+    av_dict_free(&options);
+    mmap_io_close(&io);
+    if (modified_url)
+      free(modified_url);
+    return -1;
+  }
+
+  mf->path = strdup(path);
+  mf->filename = media_filename(path);
+
+  mf->duration = (double)context->duration / AV_TIME_BASE;
+
+  //fallback duration to zero
+  if (context->duration == AV_NOPTS_VALUE || mf->duration < 0) {
+    mf->duration = 0;
+  }
+
+  AVDictionaryEntry *title_entry =
+      av_dict_get(context->metadata, "title", NULL, 0);
+  mf->title = title_entry ? strdup(title_entry->value) : NULL;
+
+  avformat_close_input(&context);
+  av_dict_free(&options);
+  mmap_io_close(&io);
+  if (modified_url)
+    free(modified_url);
+  return 0;
 }
 
 media_file *collect_media_info(char *files[], int n, int *out_count,
-                               const char *username, const char *password) {
+                               const char *username, const char *password,
+                               int dedup_mode, journal *jr) {
+  //one slot per input file, compacted in input order at the end
   media_file *mfs = malloc(n * sizeof(media_file));
-  if (!mfs) {
+  int *order = malloc(n * sizeof(int));
+  int *probed_at = malloc(n * sizeof(int));
+  if (!mfs || !order || !probed_at) {
     perror("malloc");
+    free(mfs);
+    free(order);
+    free(probed_at);
     *out_count = 0;
     return NULL;
   }
 
-  int actual_count = 0;
-
-  for (int i = 0; i < n; i++) {
-    AVFormatContext *context = NULL;
-    AVDictionary *options = NULL;
-
-    char *url_to_open = files[i];
-    char *modified_url = NULL;
-
-    if (is_web_url(files[i])) {
-      av_dict_set(&options, "timeout", "10000000",
-                  0); // 10s
-      av_dict_set(&options, "user_agent", "libavformat", 0);
-
-      if (username && password) {
-        //ffmpeg requires embedded credentials
-        const char *auth_start = strstr(files[i], "://");
-        if (auth_start) {
-          auth_start += 3;
-          const char *at_sign = strchr(auth_start, '@');
-
-          if (at_sign) {
-            url_to_open = files[i];
-          }
-          else {
-            const char *proto_end = strstr(files[i], "://") + 3;
-            size_t proto_len = proto_end - files[i];
-            size_t new_url_len =
-                strlen(files[i]) + strlen(username) + strlen(password) + 10;
-
-            modified_url = malloc(new_url_len);
-            snprintf(modified_url, new_url_len, "%.*s%s:%s@%s", (int)proto_len,
-                     files[i], username, password, proto_end);
-            url_to_open = modified_url;
-          }
-        }
-      }
+  //dup_of[i] points at the file i is a copy of
+  int *dup_of = NULL;
+  if (dedup_mode != DEDUP_OFF) {
+    dup_of = malloc(n * sizeof(int));
+    if (dup_of && find_duplicates(files, n, dup_of) < 0) {
+      //probe everything instead
+      free(dup_of);
+      dup_of = NULL;
     }
+  }
 
-    if (avformat_open_input(&context, url_to_open, NULL, &options) != 0) {
-      fprintf(stderr, "Could not open file %s\n", files[i]);
-      av_dict_free(&options);
-      if (modified_url)
-        free(modified_url);
+  //results finished by an earlier, interrupted run cost nothing to replay,
+  //so they are taken even when the deadline has already passed. what is
+  //left, minus the copies, is all that gets planned and prefetched
+  int to_probe = 0;
+  for (int i = 0; i < n; i++) {
+    probed_at[i] = PROBE_PENDING;
+    if (dup_of && dup_of[i] >= 0)
       continue;
-    }
+    if (journal_lookup(jr, files[i], &mfs[i]))
+      probed_at[i] = i;
+    else
+      order[to_probe++] = i;
+  }
 
-    if (is_web_url(files[i])) {
-      context->max_analyze_duration = ANALYSIS_DURATION;
-      context->probesize = PROBE_SIZE;
-    }
+  //probe in on-disk order, keeping the next few headers in flight
+  plan_probe_order(files, order, to_probe);
+  prefetch_headers(files, order, to_probe, 0, READAHEAD_FILES);
 
-    if (avformat_find_stream_info(context, NULL) < 0) {
-      fprintf(stderr, "Could not find stream information for file %s\n",
-              files[i]);
-      avformat_close_input(&context);
-      av_dict_free(&options);
-      if (modified_url)
-        free(modified_url);
-      continue;
-    }
+  for (int k = 0; k < to_probe && !probe_should_stop(NULL); k++) {
+    int i = order[k];
 
-    media_file *mf = &mfs[actual_count];
-    mf->path = strdup(files[i]);
-
-    if (is_web_url(files[i])) {
-      const char *last_slash = strrchr(files[i], '/');
-      if (last_slash && *(last_slash + 1)) {
-        char *filename = strdup(last_slash + 1);
-        //remove queries
-        char *query = strchr(filename, '?');
-        if (query)
-          *query = '\0';
-        mf->filename = filename;
-      }
-      else {
-        mf->filename = strdup("webstream");
-      }
+    prefetch_headers(files, order, to_probe, k + READAHEAD_FILES, 1);
+
+    if (probe_media(files[i], &mfs[i], username, password) == 0) {
+      probed_at[i] = i;
+      journal_append(jr, &mfs[i]);
     }
-    else {
-      char *path_copy = strdup(files[i]);
-      mf->filename = strdup(basename(path_copy));
-      free(path_copy);
+    else if (!probe_should_stop(NULL)) {
+      probed_at[i] = PROBE_FAILED;
     }
+  }
 
-    mf->duration = (double)context->duration / AV_TIME_BASE;
+  //past the deadline, files never probed are listed with unknown duration
+  int keep_pending = !probe_interrupted && probe_deadline_expired();
 
-    //fallback duration to zero
-    if (context->duration == AV_NOPTS_VALUE || mf->duration < 0) {
-      mf->duration = 0;
+  //results go out in the requested order regardless of probe order.
+  //slots below i are either moved already or unused, so this is in place
+  int actual_count = 0;
+
+  for (int i = 0; i < n; i++) {
+    if (dup_of && dup_of[i] >= 0) {
+      int src = probed_at[dup_of[i]];
+      if (dedup_mode == DEDUP_COLLAPSE || src < 0)
+        continue;
+
+      //copies of a pending representative come out pending as well
+      media_file *mf = &mfs[actual_count];
+      mf->path = strdup(files[i]);
+      mf->filename = media_filename(files[i]);
+      mf->duration = mfs[src].duration;
+      mf->title = mfs[src].title ? strdup(mfs[src].title) : NULL;
+      probed_at[i] = actual_count++;
+      continue;
     }
 
-    AVDictionaryEntry *title_entry =
-        av_dict_get(context->metadata, "title", NULL, 0);
-    mf->title = title_entry ? strdup(title_entry->value) : NULL;
+    if (probed_at[i] == PROBE_PENDING && keep_pending) {
+      media_file *mf = &mfs[actual_count];
+      mf->path = strdup(files[i]);
+      mf->filename = media_filename(files[i]);
+      mf->duration = DURATION_PENDING;
+      mf->title = NULL;
+      probed_at[i] = actual_count++;
+      continue;
+    }
 
-    avformat_close_input(&context);
-    av_dict_free(&options);
-    if (modified_url)
-      free(modified_url);
-    actual_count++;
+    if (probed_at[i] < 0)
+      continue;
+
+    mfs[actual_count] = mfs[i];
+    probed_at[i] = actual_count++;
   }
 
+  mmap_io_release_pool();
+  free(dup_of);
+  free(order);
+  free(probed_at);
   *out_count = actual_count;
   return mfs;
 }
 
+//probes up to batch entries left at DURATION_PENDING, starting at *next.
+//returns how many were handled, 0 once nothing is left
+int backfill_media_info(media_file mfs[], int count, int *next, int batch,
+                        const char *username, const char *password,
+                        journal *jr) {
+  int done = 0;
+
+  for (; *next < count && done < batch && !probe_interrupted; (*next)++) {
+    media_file *mf = &mfs[*next];
+    if (mf->duration != DURATION_PENDING)
+      continue;
+
+    media_file probed;
+    if (probe_media(mf->path, &probed, username, password) == 0) {
+      journal_append(jr, &probed);
+      free(mf->path);
+      free(mf->filename);
+      if (mf->title)
+        free(mf->title);
+      *mf = probed;
+    }
+    else if (probe_interrupted) {
+      break;
+    }
+    else {
+      //a run without a deadline would have dropped it, so does the output
+      mf->duration = DURATION_FAILED;
+    }
+    done++;
+  }
+
+  return done;
+}
+
 int write_m3u(media_file mfs[], int count, const char *filename, int embed_auth,
               const char *username, const char *password) {
   char filepath[PATH_MAX];
@@ -155,11 +326,13 @@ int write_m3u(media_file mfs[], int count, const char *filename, int embed_auth,
     strncat(filepath, output_file, sizeof(filepath) - strlen(filepath) - 1);
   }
 
-  FILE *fp = fopen(filepath, "w");
-  if (!fp) {
-    perror("fopen");
+  //written next to the target and renamed over it, so readers never see
+  //a half written playlist when it is rewritten
+  char target[PATH_MAX];
+  char tmppath[REPLACE_TMP_MAX];
+  FILE *fp = replace_file_open(filepath, target, tmppath);
+  if (!fp)
     return -1;
-  }
 
   fprintf(fp, "#EXTM3U\n");
 
@@ -205,7 +378,8 @@ int write_m3u(media_file mfs[], int count, const char *filename, int embed_auth,
     }
   }
 
-  fclose(fp);
+  if (replace_file_commit(fp, tmppath, target) != 0)
+    return -1;
 
   //printf("Playlist written to: %s\n", filepath);
   return 0;
@@ -4,6 +4,11 @@
 
 #define ANALYSIS_DURATION 5000000 //5s
 #define PROBE_SIZE 1000000        //1mb
+#define DURATION_PENDING -1       //not probed yet, see --deadline
+#define DURATION_FAILED -2        //backfill could not probe it, not written
+#define BACKFILL_BATCH 64         //probes between playlist rewrites
+
+#include <signal.h>
 
 typedef struct {
   char *path;
@@ -12,8 +17,20 @@ typedef struct {
   char *title;
 } media_file;
 
+typedef struct journal journal;
+
+//set from a signal handler to stop probing and keep what is done
+extern volatile sig_atomic_t probe_interrupted;
+
+void set_probe_deadline(double seconds);
+int probe_deadline_expired(void);
+
 media_file *collect_media_info(char *files[], int n, int *out_count,
-                               const char *username, const char *password);
+                               const char *username, const char *password,
+                               int dedup_mode, journal *jr);
+int backfill_media_info(media_file mfs[], int count, int *next, int batch,
+                        const char *username, const char *password,
+                        journal *jr);
 int write_m3u(media_file mfs[], int count, const char *filename, int embed_auth,
               const char *username, const char *password);
 void free_media_files(media_file *mfs, int count);